@@ -29,17 +29,28 @@ class Opacity( object ) :
             path = "/project/projectdirs/snfactry/rthomas/local/share/es/"
             return Opacity( path + "lines", path + "refs.dat", "exp", 10.0, -2.0 )            
     
-    def __init__( self, line_dir, ref_file, form, v_ref, log_tau_min ) :
+    def __init__( self, line_dir, ref_file, form, v_ref, log_tau_min, temp_size = None, share_lines = None, cull_lines = None, incremental = None ) :
         self.line_dir    = line_dir
         self.ref_file    = ref_file
         self.form        = form
         self.v_ref       = v_ref
         self.log_tau_min = log_tau_min
+        self.temp_size   = temp_size
+        self.share_lines = share_lines
+        self.cull_lines  = cull_lines
+        self.incremental = incremental
 
     def __repr__( self ) :
         output = "opacity :\n"
         for attr in "line_dir ref_file form v_ref log_tau_min".split() :
             output += "    %-12s : %s\n" % ( attr, getattr( self, attr ) )
+        for attr in "temp_size share_lines cull_lines incremental".split() :
+            value = getattr( self, attr )
+            if value is None :
+                continue
+            if type( value ) is bool :
+                value = "Yes" if value else "No"
+            output += "    %-12s : %s\n" % ( attr, value )
         return output.rstrip()
 
 class Source( object ) :
@@ -28,15 +28,27 @@ class Evaluator( object ) :
         params[ "regions" ] = regions
         return Evaluator( **params )
 
-    def __init__( self, target_file, vector_norm, regions ) :
+    def __init__( self, target_file, vector_norm, regions, fit_warp = None, early_abort = None, batch_size = None, tree = None, speculate = None, reduce = None ) :
         self.target_file = target_file
         self.vector_norm = vector_norm
         self.regions     = regions
+        self.fit_warp    = fit_warp
+        self.early_abort = early_abort
+        self.batch_size  = batch_size
+        self.tree        = tree
+        self.speculate   = speculate
+        self.reduce      = reduce
 
     def __repr__( self ) :
         output =  "evaluator :\n"
         output += "    %-12s : %s\n" % ( "target_file", self.target_file )
         output += "    %-12s : %s\n" % ( "vector_norm", self.vector_norm )
+        for attr in "fit_warp early_abort tree speculate reduce".split() :
+            value = getattr( self, attr )
+            if value is not None :
+                output += "    %-12s : %s\n" % ( attr, "Yes" if value else "No" )
+        if self.batch_size is not None :
+            output += "    %-12s : %s\n" % ( "batch_size", self.batch_size )
         output += "    %-12s :\n" % "regions"
         for attr in "apply weight lower upper".split() :
             output += "        %-8s : [ " % attr
@@ -116,6 +128,55 @@ class Config( object ) :
         self.t_phot     = t_phot
         self.ions       = ions
 
+    #- Full parameter list from a search vector that leaves out fixed
+    #- parameters and lists each tied group once (evaluator reduce).
+
+    def expand( self, values, fit_warp = False ) :
+
+        active    = [ ion for ion in self.ions if ion.active ]
+        num_ions  = len( active )
+        w         = 0 if fit_warp else 3
+        variables = [] if fit_warp else [ self.a0, self.a1, self.a2 ]
+        variables += [ self.v_phot, self.v_outer, self.t_phot ]
+        for var_name in "log_tau v_min v_max aux temp".split() :
+            variables += [ getattr( ion, var_name ) for ion in active ]
+
+        #- Attached ions tie v_min to v_phot, repeated ions tie temperatures.
+
+        lead = list( range( len( variables ) ) )
+        def find( k ) :
+            while lead[ k ] != k :
+                k = lead[ k ]
+            return k
+        def tie( a, b ) :
+            a, b = find( a ), find( b )
+            lead[ max( a, b ) ] = min( a, b )
+        for j, ion in enumerate( active ) :
+            if not ion.detach :
+                tie( w, w + 3 + 1 * num_ions + j )
+            for jj in range( j + 1, num_ions ) :
+                if active[ jj ].ion == ion.ion :
+                    tie( w + 3 + 4 * num_ions + j, w + 3 + 4 * num_ions + jj )
+
+        #- A group with a fixed member takes the start of the first one, every
+        #- other group is the next search parameter.
+
+        fixed = {}
+        for k, variable in enumerate( variables ) :
+            if variable.fixed and find( k ) not in fixed :
+                fixed[ find( k ) ] = variable.start
+        index  = {}
+        params = []
+        for k in range( len( variables ) ) :
+            group = find( k )
+            if group in fixed :
+                params.append( fixed[ group ] )
+                continue
+            if group not in index :
+                index[ group ] = len( index )
+            params.append( values[ index[ group ] ] )
+        return params
+
     def __repr__( self ) :
         output =  "config :\n"
         output += "    %-12s : %s\n" % ( "fit_file"  , self.fit_file   )
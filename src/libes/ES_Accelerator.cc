@@ -32,22 +32,13 @@
 double ES::Accelerator::operator() ( double const x )
 {
     std::map< double, double >::iterator right = _cache.upper_bound( x );
-    if( right != _cache.end() )
+    if( right != _cache.end() && right != _cache.begin() )
     {
         std::map< double, double >::iterator left = right;
         -- left;
-        if( left != right )
-        {
-            double a = ( right->first - x ) / ( right->first - left->first );
-            double b = 1.0 - a;
-            return a * left->second + b * right->second;
-        }
-        else
-        {
-            double y = evaluate( x );
-            _insert( x, y );
-            return y;
-        }
+        double a = ( right->first - x ) / ( right->first - left->first );
+        double b = 1.0 - a;
+        return a * left->second + b * right->second;
     }
     else
     {
@@ -28,9 +28,9 @@
 #ifndef ES__BLACKBODY
 #define ES__BLACKBODY
 
-#include "ES_Accelerator.hh"
+#include "ES_FlatAccelerator.hh"
 
-#include <map>
+#include <cmath>
 
 namespace ES
 {
@@ -39,21 +39,27 @@ namespace ES
     /// @brief Blackbody spectral energy distribution.
     ///
     /// Normalized to an intensity of approximately 1 at peak, in F-nu units.
+    ///
+    /// In these units the response depends on wavelength and temperature
+    /// only through their product, so the table is keyed on the product.
+    /// One table then serves every temperature:  changing the temperature
+    /// does not clear it, and temperatures revisited during a fit reuse
+    /// the octaves already tabulated for them.
 
-    class Blackbody : public ES::Accelerator
+    class Blackbody : public ES::FlatAccelerator< Blackbody >
     {
 
         public :
 
             /// Constructor.
 
-            Blackbody( double const tolerance = 0.001 ) :
-                ES::Accelerator( tolerance ) {}
+            Blackbody( double const tolerance = 0.001, int const order = 1 ) :
+                ES::FlatAccelerator< Blackbody >( tolerance, order ) {}
 
             /// @name temp
             /// Temperature in kK.
             ///@{
-            double& temp()       { clear(); return _temp; }
+            double& temp()       { return _temp; }
             double  temp() const { return _temp; }
             ///@}
 
@@ -61,9 +67,23 @@ namespace ES
 
             double wl_peak() const;
 
-            /// Returns the blackbody responses (F-nu units) at the given wavelength in AA.
+            /// Returns the tabulated response at the given wavelength in AA.
+
+            double operator() ( double const wl ) const { return ES::FlatAccelerator< Blackbody >::operator()( wl * _temp ); }
+
+            /// Extend the table over a wavelength range in AA at the current
+            /// temperature.
+
+            void tabulate( double const min_wl, double const max_wl ) { ES::FlatAccelerator< Blackbody >::tabulate( min_wl * _temp, max_wl * _temp ); }
+
+            /// Returns the blackbody response (F-nu units) at the given product
+            /// of wavelength in AA and temperature in kK.
 
-            virtual double evaluate( double const wl ) const;
+            double evaluate( double const wlt ) const
+            {
+                double owl = 50994.364 / wlt;
+                return owl * owl * owl * ( exp( 2.82143937212 ) - 1.0 ) / ( exp( 2.82143937212 * owl ) - 1.0 );
+            }
 
         private :
 
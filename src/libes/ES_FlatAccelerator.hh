@@ -0,0 +1,190 @@
+// 
+// File    : ES_FlatAccelerator.hh
+// -------------------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so. 
+//
+
+#ifndef ES__FLATACCELERATOR
+#define ES__FLATACCELERATOR
+
+#include "ES_Exception.hh"
+
+#include <vector>
+#include <cmath>
+
+namespace ES
+{
+
+    /// @class FlatAccelerator
+    /// @brief Flat-table interpolating function accelerator.
+    ///
+    /// Same idea as ES::Accelerator, but lookups are an index computation
+    /// and one interpolation instead of a tree walk.  Each octave of the
+    /// input [ 2^(e-1), 2^e ) gets its own uniform table, with a power of
+    /// two number of intervals chosen adaptively so that the relative
+    /// interpolation error at interval midpoints is within tolerance.
+    /// So the table is piecewise uniform, fine where the function varies
+    /// a lot and coarse where it is smooth.  All octaves live in a single
+    /// contiguous array, and frexp() locates the octave.
+    ///
+    /// Interpolation order is linear (1) or cubic (3); cubic meets the 
+    /// same tolerance with far fewer nodes.
+    ///
+    /// This is a template on the function type F, which inherits from
+    /// FlatAccelerator< F > and defines a non-virtual const evaluate()
+    /// method that can be inlined.  Inputs must be positive.
+    ///
+    /// The table only grows in tabulate(), which is not thread-safe.
+    /// Lookups never modify the object, so threads can share it.  Inputs
+    /// outside the tabulated octaves are evaluated directly.
+
+    template< typename F >
+        class FlatAccelerator
+        {
+
+            public :
+
+                /// Constructor.
+
+                FlatAccelerator( double const tolerance, int const order = 1 ) :
+                    _tolerance( tolerance ), _order( order ), _e_min( 1 ), _e_max( 0 )
+                {
+                    if( order != 1 && order != 3 ) throw ES::Exception( "FlatAccelerator order must be 1 or 3" );
+                }
+
+                /// Empty the table.
+
+                void clear() { _e_min = 1; _e_max = 0; _offset.clear(); _scale.clear(); _y.clear(); }
+
+                /// Extend the table to cover an input range.  This is free if
+                /// the table already covers the range.
+
+                void tabulate( double const min_x, double const max_x )
+                {
+                    int e_lo, e_hi;
+                    frexp( min_x, &e_lo );
+                    frexp( max_x, &e_hi );
+                    if( _e_min <= _e_max )
+                    {
+                        if( e_lo >= _e_min && e_hi <= _e_max ) return;
+                        if( e_lo > _e_min ) e_lo = _e_min;
+                        if( e_hi < _e_max ) e_hi = _e_max;
+                    }
+
+                    // Rebuild the arrays, reusing octaves already tabulated.
+
+                    std::vector< int    > offset;
+                    std::vector< double > scale;
+                    std::vector< double > y;
+                    for( int e = e_lo; e <= e_hi; ++ e )
+                    {
+                        offset.push_back( y.size() );
+                        if( e >= _e_min && e <= _e_max )
+                        {
+                            int j = e - _e_min;
+                            int n = int( _scale[ j ] ) / 2;
+                            y.insert( y.end(), _y.begin() + _offset[ j ], _y.begin() + _offset[ j ] + n + 3 );
+                            scale.push_back( _scale[ j ] );
+                        }
+                        else
+                        {
+                            scale.push_back( 2.0 * _octave( e, y ) );
+                        }
+                    }
+                    _offset.swap( offset );
+                    _scale.swap( scale );
+                    _y.swap( y );
+                    _e_min = e_lo;
+                    _e_max = e_hi;
+                }
+
+                /// Returns a response for a single input.
+
+                double operator() ( double const x ) const
+                {
+                    int    e;
+                    double m = frexp( x, &e );
+                    if( e < _e_min || e > _e_max ) return static_cast< const F* >( this )->evaluate( x );
+                    int    j = e - _e_min;
+                    double u = ( m - 0.5 ) * _scale[ j ];
+                    int    i = int( u );
+                    return _interpolate( &_y[ _offset[ j ] + 1 + i ], u - i );
+                }
+
+            private :
+
+                double                _tolerance;    ///< Maximum relative error allowed at interval midpoints.
+                int                   _order;        ///< Interpolation order, 1 or 3.
+                int                   _e_min;        ///< Lowest tabulated binary exponent.
+                int                   _e_max;        ///< Highest tabulated binary exponent.
+                std::vector< int    > _offset;       ///< Start of each octave's nodes in the table.
+                std::vector< double > _scale;        ///< Twice the number of intervals in each octave.
+                std::vector< double > _y;            ///< Table of responses at nodes.
+
+                /// Interpolate at fraction f of the interval starting at node y[ 0 ].
+                /// Nodes y[ -1 ] and y[ 2 ] are used for cubic interpolation.
+
+                double _interpolate( const double* y, double const f ) const
+                {
+                    if( _order == 1 ) return y[ 0 ] + f * ( y[ 1 ] - y[ 0 ] );
+                    double g = f - 1.0;
+                    double h = f - 2.0;
+                    double k = f + 1.0;
+                    return ( - f * g * h * y[ -1 ] + 3.0 * k * g * h * y[ 0 ] - 3.0 * k * f * h * y[ 1 ] + k * f * g * y[ 2 ] ) / 6.0;
+                }
+
+                /// Append the nodes for octave e to the table, doubling the
+                /// number of intervals until the tolerance is met.  Each octave
+                /// carries one extra node on either end for cubic interpolation.
+                /// Returns the number of intervals.  Throws if 4096 intervals
+                /// still miss the tolerance.
+
+                int _octave( int const e, std::vector< double >& y ) const
+                {
+                    const F* f = static_cast< const F* >( this );
+                    std::vector< double > node;
+                    int n = 1;
+                    while( true )
+                    {
+                        node.resize( n + 3 );
+                        for( int i = 0; i < n + 3; ++ i ) node[ i ] = f->evaluate( ldexp( 0.5 + 0.5 * ( i - 1 ) / n, e ) );
+                        bool ok = true;
+                        for( int i = 0; i < n && ok; ++ i )
+                        {
+                            double yf = f->evaluate( ldexp( 0.5 + 0.5 * ( i + 0.5 ) / n, e ) );
+                            ok = fabs( _interpolate( &node[ i + 1 ], 0.5 ) - yf ) <= _tolerance * fabs( yf );
+                        }
+                        if( ok ) break;
+                        if( n >= 4096 ) throw ES::Exception( "FlatAccelerator tolerance not met with 4096 intervals per octave" );
+                        n *= 2;
+                    }
+                    y.insert( y.end(), node.begin(), node.end() );
+                    return n;
+                }
+
+        };
+
+}
+
+#endif
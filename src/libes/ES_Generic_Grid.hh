@@ -78,18 +78,44 @@ namespace ES
 
                 public :
 
+                    /// Constructor.
+
+                    Grid() : _has_last( false ) {}
+
                     /// Add an operator to the stack.
 
-                    void push_operator( O& oper ) { _oper.push_back( &oper ); }
+                    void push_operator( O& oper ) { _oper.push_back( &oper ); _has_last = false; }
 
                     /// Execute a Setup by passing it to each Operator in the
                     /// stack in succession.  These Operators use and modify
                     /// the Grid.
+                    ///
+                    /// The Setup is compared to the previous one with
+                    /// S::diff(), which returns a bit mask of the field
+                    /// groups that changed.  If reset() depends on any of
+                    /// them, or the first Operator does, everything runs
+                    /// from a reset Grid.  Otherwise the leading Operators
+                    /// that depend on none of them are skipped, the rest
+                    /// are updated in place, and if nothing changed at all
+                    /// nothing runs.
 
                     void operator() ( S& setup ) 
                     { 
-                        reset( setup );
-                        for( size_t i = 0; i < _oper.size(); ++ i ) (*(_oper[ i ] ))( setup ); 
+                        unsigned changed = _has_last ? setup.diff( _last ) : ~0u;
+                        _last     = setup;
+                        _has_last = true;
+
+                        size_t first = 0;
+                        while( first < _oper.size() && ! ( _oper[ first ]->depends() & changed ) ) ++ first;
+
+                        if( ( depends() & changed ) || first == 0 )
+                        {
+                            reset( setup );
+                            for( size_t i = 0; i < _oper.size(); ++ i ) (*(_oper[ i ] ))( setup ); 
+                            return;
+                        }
+
+                        for( size_t i = first; i < _oper.size(); ++ i ) _oper[ i ]->update( setup, changed );
                     }
 
                     /// Prepare the Grid for a new calculation, placing it in
@@ -99,12 +125,26 @@ namespace ES
 
                     virtual void reset( S& setup ) {}
 
+                    /// Bit mask of the Setup field groups reset() reads.
+                    /// The default is to depend on everything.
+
+                    virtual unsigned depends() const { return ~0u; }
+
+                    /// Forget the previous Setup, so the next one runs in
+                    /// full.  Call this after changing an Operator's
+                    /// configuration between Setups.
+
+                    void invalidate() { _has_last = false; }
+
                 private :
 
                     /// Stack of references to generic Operator objects.
 
                     std::vector< O* > _oper;
 
+                    S    _last;             ///< Previous Setup executed.
+                    bool _has_last;         ///< If false, there is no previous Setup.
+
             };
 
     }
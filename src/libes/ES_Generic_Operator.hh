@@ -76,6 +76,21 @@ namespace ES
 
                     virtual void operator() ( const S& setup ) = 0;
 
+                    /// Bit mask of the Setup field groups (see S::diff())
+                    /// this Operator reads, directly or through the Grid
+                    /// members earlier Operators fill in.  The Grid skips
+                    /// an Operator when none of them changed.  The default
+                    /// is to depend on everything.
+
+                    virtual unsigned depends() const { return ~0u; }
+
+                    /// Executes a Setup that differs from the previous one
+                    /// only in the field groups in the changed mask, with
+                    /// the Grid left as the previous Setup left it.  The
+                    /// default is a full execution; override to do less.
+
+                    virtual void update( const S& setup, unsigned const ) { (*this)( setup ); }
+
                 protected :
 
                     /// Reference to the concrete Grid object this Operator is
@@ -36,6 +36,34 @@
 #include <iomanip>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    bool entry_less( const ES::LineManager::StoreEntry& l, const ES::LineManager::StoreEntry& r ) { return l.ion < r.ion; }
+}
+
+ES::LineManager::LineManager( const std::string& line_dir, double const min_wl, double const max_wl ) :
+    _line_dir( line_dir ),
+    _min_wl( min_wl ),
+    _max_wl( max_wl ),
+    _store_open( false ),
+    _store( 0 ),
+    _store_size( 0 ),
+    _store_index( 0 ),
+    _store_lines( 0 ),
+    _store_ions( 0 )
+{}
+
+ES::LineManager::~LineManager()
+{
+    if( _store ) munmap( _store, _store_size );
+}
 
 void ES::LineManager::load( const std::vector< int >& ions, std::vector< ES::Line >& lines )
 {
@@ -44,6 +72,39 @@ void ES::LineManager::load( const std::vector< int >& ions, std::vector< ES::Lin
 }
 
 void ES::LineManager::load( int const ion, std::vector< ES::Line >& lines )
+{
+
+    if( ! _store_open ) _open_store();
+
+    size_t middle = lines.size();
+
+    // Copy the ion's lines in range from the line store, where they are
+    // already sorted.  Otherwise decode and sort them.
+
+    StoreEntry key;
+    key.ion = ion;
+    const StoreEntry* entry = _store ? std::lower_bound( _store_index, _store_index + _store_ions, key, entry_less ) : 0;
+    if( entry && entry != _store_index + _store_ions && entry->ion == ion )
+    {
+        const ES::Line* first = _store_lines + entry->offset;
+        const ES::Line* last  = first + entry->size;
+        first = std::lower_bound( first, last, ES::Line( ion, _min_wl ) );
+        last  = std::upper_bound( first, last, ES::Line( ion, _max_wl ) );
+        lines.insert( lines.end(), first, last );
+    }
+    else
+    {
+        load_fits( ion, lines );
+        std::sort( lines.begin() + middle, lines.end() );
+    }
+
+    // Merge with lines already in the list.
+
+    std::inplace_merge( lines.begin(), lines.begin() + middle, lines.end() );
+
+}
+
+void ES::LineManager::load_fits( int const ion, std::vector< ES::Line >& lines )
 {
 
     // Compute path to line file.
@@ -124,3 +185,63 @@ void ES::LineManager::drop( int const ion, std::vector< ES::Line >& lines )
         std::stable_partition( lines.begin(), lines.end(), std::bind2nd( std::not_equal_to< ES::Line >(), dummy ) );
     lines.erase( middle, lines.end() );
 }
+
+void ES::LineManager::_open_store()
+{
+
+    // Map the line store read-only, if there is one.
+
+    _store_open = true;
+
+    std::string file = store_file( _line_dir );
+    int fd = open( file.c_str(), O_RDONLY );
+    if( fd < 0 ) return;
+
+    struct stat info;
+    if( fstat( fd, &info ) != 0 || size_t( info.st_size ) < sizeof( StoreHeader ) )
+    {
+        close( fd );
+        throw ES::Exception( "Unable to read line store file: '" + file + "'" );
+    }
+    _store_size = info.st_size;
+    _store = mmap( 0, _store_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( _store == MAP_FAILED )
+    {
+        _store = 0;
+        throw ES::Exception( "Unable to map line store file: '" + file + "'" );
+    }
+
+    // Check the header, then locate the index and line records.
+
+    const StoreHeader* header = static_cast< const StoreHeader* >( _store );
+    if( std::strncmp( header->magic, "ESLINES", 8 ) != 0 || header->version != 1 || header->line_bytes != int( sizeof( ES::Line ) ) ||
+            header->ion_size < 0 || ( _store_size - sizeof( StoreHeader ) ) / sizeof( StoreEntry ) < size_t( header->ion_size ) )
+    {
+        munmap( _store, _store_size );
+        _store = 0;
+        throw ES::Exception( "Incompatible line store file, rebuild it with lineprep: '" + file + "'" );
+    }
+
+    const StoreEntry* index = reinterpret_cast< const StoreEntry* >( header + 1 );
+
+    // Every ion's records must lie inside the file, and the index must be
+    // sorted for lookups, or the file is truncated or corrupt.
+
+    long long line_size = ( _store_size - sizeof( StoreHeader ) - header->ion_size * sizeof( StoreEntry ) ) / sizeof( ES::Line );
+    for( int i = 0; i < header->ion_size; ++ i )
+    {
+        if( index[ i ].offset < 0 || index[ i ].size < 0 || index[ i ].offset > line_size || index[ i ].size > line_size - index[ i ].offset ||
+                ( i > 0 && index[ i - 1 ].ion >= index[ i ].ion ) )
+        {
+            munmap( _store, _store_size );
+            _store = 0;
+            throw ES::Exception( "Corrupt line store file, rebuild it with lineprep: '" + file + "'" );
+        }
+    }
+
+    _store_ions  = header->ion_size;
+    _store_index = index;
+    _store_lines = reinterpret_cast< const ES::Line* >( _store_index + _store_ions );
+
+}
@@ -43,28 +43,59 @@ namespace ES
     /// types of containers could be added but a vector that one externally
     /// sorts seems to have a lot less overhead in both memory usage and 
     /// speed.  
+    ///
+    /// Lines come from per-ion Kurucz FITS files in the line directory,
+    /// unless the directory also holds a line store written by lineprep.
+    /// The store holds every ion's decoded lines as wavelength-sorted
+    /// ES::Line records behind an ion index.  It is memory-mapped, so
+    /// loading an ion from it is a binary search and a copy.
 
     class LineManager
     {
 
         public :
 
+            /// Line store header.
+
+            struct StoreHeader
+            {
+                char magic[ 8 ];        ///< File identifier, "ESLINES".
+                int  version;           ///< Format version.
+                int  line_bytes;        ///< Size of an ES::Line record.
+                int  ion_size;          ///< Number of ions.
+                int  padding;           ///< Unused.
+            };
+
+            /// Line store ion index entry.
+
+            struct StoreEntry
+            {
+                int       ion;          ///< Ion code.
+                int       padding;      ///< Unused.
+                long long offset;       ///< Index of the ion's first line record.
+                long long size;         ///< Number of the ion's line records.
+            };
+
             /// Constructor.
 
-            LineManager( const std::string& line_dir, double const min_wl, double const max_wl ) :
-                _line_dir( line_dir ), _min_wl( min_wl ), _max_wl( max_wl ) {}
+            LineManager( const std::string& line_dir, double const min_wl, double const max_wl );
 
             /// Destructor.
 
-            ~LineManager() {}
+            ~LineManager();
 
             /// @name load
             /// Insert lines into the list matching a list of ions or an ion.
+            /// A list sorted by wavelength stays sorted.
             ///@{
             void load( const std::vector< int >& ions, std::vector< ES::Line >& lines );
             void load( int const ion, std::vector< ES::Line >& lines );
             ///@}
 
+            /// Append lines for an ion decoded from its FITS file, unsorted.
+
+            void load_fits( int const ion, std::vector< ES::Line >& lines );
+
             /// @name drop
             /// Remove lines from the list matching a list of ions or an ion.
             ///@{
@@ -72,12 +103,38 @@ namespace ES
             void drop( int const ion, std::vector< ES::Line >& lines );
             ///@}
 
+            /// Path of the line store in a line directory.  When the store
+            /// exists, every ion it holds is loaded from it and its FITS
+            /// file is not read, even if newer.  Rerun lineprep after
+            /// changing the FITS files.
+
+            static std::string store_file( const std::string& line_dir ) { return line_dir + "/line.kurucz.db"; }
+
         protected :
 
             std::string _line_dir; ///< Directory where line list files are kept.
             double      _min_wl;   ///< Minimum wavelength to admit to list in AA.
             double      _max_wl;   ///< Maximum wavelength to admit to list in AA.
 
+        private :
+
+            bool               _store_open;   ///< If true, the line store has been looked for.
+            void*              _store;        ///< Mapped line store, or null.
+            size_t             _store_size;   ///< Size of mapped line store in bytes.
+            const StoreEntry*  _store_index;  ///< Line store ion index, sorted by ion.
+            const ES::Line*    _store_lines;  ///< Line store records.
+            int                _store_ions;   ///< Number of ions in line store.
+
+            /// Map the line store, if there is one.  Done on first load, so
+            /// a manager that never loads lines never touches the file.
+
+            void _open_store();
+
+            /// Not copyable, because of the mapping.
+
+            LineManager( const LineManager& );
+            LineManager& operator = ( const LineManager& );
+
     };
 
 }
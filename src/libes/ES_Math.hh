@@ -0,0 +1,93 @@
+// 
+// File    : ES_Math.hh
+// --------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so. 
+//
+
+#ifndef ES__MATH
+#define ES__MATH
+
+#include <cstring>
+
+namespace ES
+{
+
+    /// @namespace ES::Math
+    /// @brief Inline math kernels for the innermost loops.
+
+    namespace Math
+    {
+
+        /// Returns exp( - x ) for x >= 0.
+        ///
+        /// Unlike the libm call, this is branch-free straight-line code
+        /// (Cody-Waite range reduction and a degree-12 polynomial), so 
+        /// compilers can vectorize loops that call it.  Relative error 
+        /// is a few ulp.  Arguments beyond 708 are clamped, giving about 
+        /// 3e-308 instead of underflowing to zero.
+
+        inline double exp_neg( double x )
+        {
+            // Clamp arithmetically: compilers will not if-convert a
+            // floating-point select under default (trapping) math.
+
+            x -= ( x > 708.0 ) * ( x - 708.0 );
+
+            // Split -x = n ln 2 + r with |r| <= ln 2 / 2.  Adding 1.5 * 2^52
+            // rounds to the nearest integer and leaves n in the low bits.
+
+            double t = 6755399441055744.0 - x * 1.4426950408889634;
+            double n = t - 6755399441055744.0;
+            double r = ( - x - n * 6.93147180369123816490e-01 ) - n * 1.90821492927058770002e-10;
+
+            double p = 1.0 / 479001600.0;
+            p = p * r + 1.0 / 39916800.0;
+            p = p * r + 1.0 / 3628800.0;
+            p = p * r + 1.0 / 362880.0;
+            p = p * r + 1.0 / 40320.0;
+            p = p * r + 1.0 / 5040.0;
+            p = p * r + 1.0 / 720.0;
+            p = p * r + 1.0 / 120.0;
+            p = p * r + 1.0 / 24.0;
+            p = p * r + 1.0 / 6.0;
+            p = p * r + 0.5;
+            p = p * r + 1.0;
+            p = p * r + 1.0;
+
+            // Scale by 2^n, building the exponent field directly.
+
+            unsigned long long bits;
+            std::memcpy( &bits, &t, sizeof( bits ) );
+            bits = ( bits + 1023 ) << 52;
+            double scale;
+            std::memcpy( &scale, &bits, sizeof( scale ) );
+
+            return p * scale;
+        }
+
+    }
+
+}
+
+#endif
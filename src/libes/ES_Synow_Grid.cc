@@ -46,10 +46,13 @@ ES::Synow::Grid ES::Synow::Grid::create( double const min_output_wl, double cons
 }
 
 ES::Synow::Grid::Grid( double const min_wl_, double const max_wl_, double const bin_width_, int const v_size_ ) :
-    min_wl( min_wl_ ), max_wl( max_wl_ ), bin_width( bin_width_ ), v_size( v_size_ ) 
+    min_wl( min_wl_ ), max_wl( max_wl_ ), bin_width( bin_width_ ), factor( 1.0 + bin_width_ / C_KKMS ), v_size( v_size_ ) 
 {
-    wl_size = int( log( max_wl / min_wl ) / log( 1.0 + bin_width / 299.792 ) + 0.5 );
+    wl_size = int( log( max_wl / min_wl ) / log( factor ) + 0.5 );
+    _center = log( 0.5 * ( 1.0 + factor ) ) / log( factor );
     wl  = new double[ wl_size ];
+    bin = new int   [ wl_size ];
+    lattice = new int[ wl_size + 1 ];
     v   = new double[  v_size ];
     tau = new double[ wl_size * v_size ];
     src = new double[ wl_size * v_size ];
@@ -60,6 +63,8 @@ ES::Synow::Grid::Grid( double const min_wl_, double const max_wl_, double const
 ES::Synow::Grid::~Grid()
 {
     delete [] wl;
+    delete [] bin;
+    delete [] lattice;
     delete [] v;
     delete [] tau;
     delete [] src;
@@ -74,16 +79,49 @@ void ES::Synow::Grid::reset( ES::Synow::Setup& setup )
     v[ 0 ] = setup.v_phot;
     v[ v_size - 1 ] = setup.v_outer;
     bb->temp() = setup.t_phot;
-    (*bb)( min_wl );
-    (*bb)( max_wl );
+
+    // Tabulate the blackbody over every Doppler-shifted wavelength the
+    // operators look up, so that threads can share it.
+
+    bb->tabulate( min_wl / ( 1.0 + setup.v_outer / C_KKMS ), max_wl * ( 1.0 + setup.v_phot / C_KKMS ) );
+}
+
+unsigned ES::Synow::Grid::depends() const
+{
+    return ES::Synow::Setup::VELOCITY | ES::Synow::Setup::PHOTOSPHERE;
+}
+
+void ES::Synow::Grid::index()
+{
+    int ib = 0;
+    for( int n = 0; n <= wl_size; ++ n )
+    {
+        while( ib < wl_used && bin[ ib ] < n ) ++ ib;
+        lattice[ n ] = ib;
+    }
+}
+
+int ES::Synow::Grid::upper( double const wl_ ) const
+{
+
+    // Bin n is centered at lattice coordinate n + _center, so the first
+    // bin redder than wl_ is the first one at or above the lattice index
+    // computed here.
+
+    double t = log( wl_ / min_wl ) / log( factor ) - _center;
+    if( t < 0.0 ) return lattice[ 0 ];
+    int n = int( t ) + 1;
+    return n < wl_size ? lattice[ n ] : lattice[ wl_size ];
 }
 
 void ES::Synow::Grid::_zero()
 {
     wl_used = 0;
+    for( int i = 0; i <= wl_size; ++ i ) lattice[ i ] = 0;
     for( int i = 0; i < wl_size * v_size; ++ i )
     {
         if( i < wl_size ) wl[ i ] = 0.0;
+        if( i < wl_size ) bin[ i ] = 0;
         if( i < v_size  ) v [ i ] = 0.0;
         tau[ i ] = 0.0;
         src[ i ] = 0.0;
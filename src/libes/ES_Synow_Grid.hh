@@ -29,6 +29,7 @@
 #define ES__SYNOW__GRID
 
 #include "ES_Generic_Grid.hh"
+#include "ES_Synow_Setup.hh"
 
 namespace ES
 {
@@ -46,8 +47,6 @@ namespace ES
 
         class Grid;
 
-        class Setup;
-
         typedef ES::Generic::Operator< ES::Synow::Grid, ES::Synow::Setup > Operator;
 
         /// @class Grid
@@ -79,20 +78,40 @@ namespace ES
 
                 virtual void reset( ES::Synow::Setup& setup );
 
+                /// Velocity grid and blackbody depend on these Setup fields.
+
+                virtual unsigned depends() const;
+
+                /// Rebuild the lattice lookup table after the wavelength bins
+                /// and their lattice indices have been assigned.
+
+                void index();
+
+                /// Returns the index of the first wavelength bin redder than
+                /// the given wavelength in AA, like std::upper_bound over wl
+                /// but without the search.
+
+                int upper( double const wl_ ) const;
+
                 double         min_wl;        ///< Bluest wavelength considered in AA.
                 double         max_wl;        ///< Reddest wavelength considered in AA.
                 double         bin_width;     ///< Opacity/source bin width in kkm/s.
+                double         factor;        ///< Wavelength ratio between neighboring bins on the lattice.
                 int            wl_size;       ///< Capacity of wavelength bin array.
                 int            wl_used;       ///< Number of wavelength bins with nonzero Sobolev opacity.
                 int            v_size;        ///< Line-forming region velocity grid size.
                 double*        wl;            ///< Wavelengths of opacity/source bin centers in Angstroms.
+                int*           bin;           ///< Lattice index of each wavelength bin, counted from min_wl.
+                int*           lattice;       ///< First wavelength bin at or redward of each lattice index.
                 double*        v;             ///< Velocity grid in kkm/s.
                 double*        tau;           ///< Sobolev opacity table.
                 double*        src;           ///< Source function table.
-                ES::Blackbody* bb;            ///< Photosphere blackbody function.
+                ES::Blackbody* bb;            ///< Photosphere blackbody function, tabulated by reset().
 
             private :
 
+                double         _center;       ///< Lattice coordinate of a bin center relative to its blue edge.
+
                 /// Zero-out wavelength/velocity axes and opacity/source tables.
 
                 void _zero();
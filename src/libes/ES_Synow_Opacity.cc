@@ -25,6 +25,10 @@
 // perform publicly and display publicly, and to permit others to do so. 
 //
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include "ES_Synow_Opacity.hh"
 #include "ES_Exception.hh"
 #include "ES_Synow_Grid.hh"
@@ -35,18 +39,170 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <iomanip>
 
 #include <iostream>
 
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+#ifdef HAVE_BLAS
+#ifdef F77_FUNC
+#define ES_DGEMM F77_FUNC( dgemm, DGEMM )
+#else
+#define ES_DGEMM dgemm_
+#endif
+extern "C" void ES_DGEMM( const char* transa, const char* transb, const int* m, const int* n, const int* k, 
+        const double* alpha, const double* a, const int* lda, const double* b, const int* ldb, 
+        const double* beta, double* c, const int* ldc );
+#endif
+
 ES::Synow::Opacity::Opacity( ES::Synow::Grid& grid, const std::string& line_dir, const std::string& ref_file,
         const std::string& form, double const v_ref, double const log_tau_min ) :
     ES::Synow::Operator( grid ),
     ES::LineManager( line_dir, grid.min_wl, grid.max_wl ),
     _ref_file( ref_file ),
     _v_ref( v_ref ),
-    _log_tau_min( log_tau_min )
+    _log_tau_min( log_tau_min ),
+    _shared( 0 ),
+    _shared_size( 0 ),
+    _line_data( 0 ),
+    _line_size( 0 ),
+    _temp_min( 0.0 ),
+    _temp_max( 0.0 ),
+    _temp_size( 0 ),
+    _indexed( false ),
+    _incremental( 0 ),
+    _cache_tabulated( false ),
+    _full_builds( 0 ),
+    _incremental_builds( 0 ),
+    _rows_built( 0 )
 {}
 
+void ES::Synow::Opacity::tabulate( double const temp_min, double const temp_max, int const temp_size )
+{
+    _temp_min  = temp_min;
+    _temp_max  = temp_max;
+    _temp_size = temp_min < temp_max ? temp_size : 0;
+    _indexed   = false;
+}
+
+void ES::Synow::Opacity::incremental( int const max_changed )
+{
+    _incremental = max_changed;
+    _cache_ions.clear();
+}
+
+void ES::Synow::Opacity::share( const ES::Line* lines, size_t const line_size )
+{
+    _shared      = lines;
+    _shared_size = lines ? line_size : 0;
+    _lines.clear();
+    _ref_lines.clear();
+    _indexed     = false;
+}
+
+void ES::Synow::Opacity::read_refs( const std::vector< int >& ions, std::vector< ES::Line >& ref_lines ) const
+{
+    std::ifstream stream;
+    stream.open( _ref_file.c_str() );
+    if( ! stream.is_open() ) throw ES::Exception( "Unable to open reference line list file: '" + _ref_file + "'" );
+
+    for( size_t i = 0; i < ions.size(); ++ i )
+    {
+        int ion;
+        double wl, gf, el;
+        bool found = false;
+        while( ! stream.eof() )
+        {
+            stream >> ion;
+            stream >> wl;
+            stream >> gf;
+            stream >> el;
+            if( stream.eof() ) break;
+            if( ion != ions[ i ] ) continue;
+            found = true;
+            break;
+        }
+        if( ! found )
+        {
+            std::stringstream ss;
+            ss << ions[ i ];
+            throw ES::Exception( "Unable to find ion in reference line list file: '" + ss.str() + "'" );
+        }
+        ref_lines.push_back( ES::Line( ion, wl, gf, el ) );
+        stream.clear();
+        stream.seekg( 0, std::ios::beg );
+    }
+    stream.close();
+
+}
+
+void ES::Synow::Opacity::share_refs( const std::vector< ES::Line >& ref_lines )
+{
+    _shared_refs.clear();
+    for( size_t i = 0; i < ref_lines.size(); ++ i ) _shared_refs[ ref_lines[ i ].ion ] = ref_lines[ i ];
+}
+
+void ES::Synow::Opacity::cull( const ES::Synow::Setup& lower, const ES::Synow::Setup& upper )
+{
+
+    // Bound the reference line opacity of each ion.  It peaks at the
+    // lowest velocity with opacity, and scale length aux is best small
+    // if that is below the reference velocity, large otherwise.
+
+    _bounds.clear();
+    for( size_t i = 0; i < upper.ions.size(); ++ i )
+    {
+        if( ! upper.active[ i ] ) continue;
+        double v_low   = std::max( lower.v_phot, lower.v_min[ i ] );
+        double aux     = _v_ref > v_low ? lower.aux[ i ] : upper.aux[ i ];
+        double profile = pow( 10.0, upper.log_tau[ i ] ) * exp( ( _v_ref - v_low ) / aux );
+        std::map< int, ES::Synow::Opacity::Bound >::iterator bound = _bounds.find( upper.ions[ i ] );
+        if( bound == _bounds.end() )
+        {
+            ES::Synow::Opacity::Bound& b = _bounds[ upper.ions[ i ] ];
+            b.max_profile = profile;
+            b.min_temp    = lower.temp[ i ];
+            b.max_temp    = upper.temp[ i ];
+        }
+        else
+        {
+            bound->second.max_profile = std::max( bound->second.max_profile, profile );
+            bound->second.min_temp    = std::min( bound->second.min_temp, lower.temp[ i ] );
+            bound->second.max_temp    = std::max( bound->second.max_temp, upper.temp[ i ] );
+        }
+    }
+
+    // Load lines and index them, culling.
+
+    _drop_ions( upper );
+    _load_ions( upper );
+    _index();
+
+}
+
+void ES::Synow::Opacity::report( std::ostream& stream ) const
+{
+    for( std::map< int, int >::const_iterator total = _ion_total.begin(); total != _ion_total.end(); ++ total )
+    {
+        std::map< int, int >::const_iterator kept = _ion_kept.find( total->first );
+        stream << std::setw( 5 ) << total->first << " : " << std::setw( 9 ) << ( kept == _ion_kept.end() ? 0 : kept->second ) 
+            << " of " << std::setw( 9 ) << total->second << " lines kept" << std::endl;
+    }
+}
+
+void ES::Synow::Opacity::report_builds( std::ostream& stream ) const
+{
+    stream << "opacity rebuilds : " << _full_builds << " full, " << _incremental_builds << " incremental (" << _rows_built << " rows)" << std::endl;
+}
+
+unsigned ES::Synow::Opacity::depends() const
+{
+    return ES::Synow::Setup::IONS | ES::Synow::Setup::VELOCITY;
+}
+
 void ES::Synow::Opacity::operator() ( const ES::Synow::Setup& setup )
 {
 
@@ -55,88 +211,299 @@ void ES::Synow::Opacity::operator() ( const ES::Synow::Setup& setup )
     _drop_ions( setup );
     _load_ions( setup );
 
-    // Resolve per-ion excitation temperatures.  Sweep ions, assigning
-    // a unique temperature to each --- precedence given to last listed.
+    // Local caching.
+
+    int v_size = _grid->v_size;
+
+    // Optical depth in a bin is a sum over its lines of line strength
+    // times the reference opacity profile of the line's ion.  Grouping
+    // lines by ion, that is the matrix product
+    //
+    //     tau( bins x v ) = S( bins x ions ) P( ions x v ),
+    //
+    // where S holds the summed line strengths of each ion in each bin.
+    // So build P and S, and multiply.  Only S depends on the line list.
+
+    // Assign each active ion a column of S.  Resolve per-ion excitation
+    // temperatures --- precedence given to last listed.
+
+    int max_ion = 0;
+    for( size_t i = 0; i < setup.ions.size(); ++ i ) if( setup.ions[ i ] > max_ion ) max_ion = setup.ions[ i ];
 
-    std::map< int, double > temp_map;
+    std::vector< int    > column( max_ion + 1, -1 );
+    std::vector< int    > ions;
+    std::vector< double > temp;
     for( size_t i = 0; i < setup.ions.size(); ++ i )
     {
         if( ! setup.active[ i ] ) continue;
-        temp_map[ setup.ions[ i ] ] = setup.temp[ i ];
+        int& j = column[ setup.ions[ i ] ];
+        if( j < 0 )
+        {
+            j = temp.size();
+            ions.push_back( setup.ions[ i ] );
+            temp.push_back( 0.0 );
+        }
+        temp[ j ] = setup.temp[ i ];
     }
+    int ion_size = temp.size();
 
-    // Resolve per-ion Sobolev reference opacity profiles.
-
-    std::map< int, std::vector< double > > tau_map;
-    for( size_t i = 0; i < setup.ions.size(); ++ i )
+    std::vector< ES::Line > ref_lines( ion_size );
+    for( std::map< int, ES::Line >::iterator ref_line = _ref_lines.begin(); ref_line != _ref_lines.end(); ++ ref_line )
     {
-        if( ! setup.active[ i ] ) continue;
-        tau_map[ setup.ions[ i ] ].resize( _grid->v_size, 0.0 );
+        ref_lines[ column[ ref_line->first ] ] = ref_line->second;
     }
 
+    // Resolve per-ion Sobolev reference opacity profiles, rows of P.
+
+    std::vector< double > profile( ion_size * v_size, 0.0 );
     for( size_t i = 0; i < setup.ions.size(); ++ i )
     {
         if( ! setup.active[ i ] ) continue;
-        double lin_tau = pow( 10.0, setup.log_tau[ i ] );
-        std::map< int, std::vector< double > >::iterator tau = tau_map.find( setup.ions[ i ] );
-        for( int iv = 0; iv < _grid->v_size; ++ iv )
+        double  lin_tau = pow( 10.0, setup.log_tau[ i ] );
+        double* tau     = &profile[ column[ setup.ions[ i ] ] * v_size ];
+        for( int iv = 0; iv < v_size; ++ iv )
         {
             if( _grid->v[ iv ] < setup.v_min[ i ] ) continue;
             if( _grid->v[ iv ] > setup.v_max[ i ] ) break;
-            tau->second[ iv ] = lin_tau * exp( ( _v_ref - _grid->v[ iv ] ) / setup.aux[ i ] );
+            tau[ iv ] = lin_tau * exp( ( _v_ref - _grid->v[ iv ] ) / setup.aux[ i ] );
         }
     }
 
-    // Initialize the first bin limits, and step the line 
-    // iterator up to the first line in the bin.
+    // Rows of S, one per bin with lines.  With every temperature inside
+    // the tabulated range, interpolate log strengths linearly in 1 / temp.
+    // Otherwise sum over each row's lines.
 
-    double factor = 1.0 + _grid->bin_width / 299.792;
-    double min_wl = _grid->min_wl;
-    double max_wl = min_wl * factor;
-    int    offset = 0;
+    if( ! _indexed ) _index();
 
-    std::vector< ES::Line >::iterator line = _lines.begin();
-    while( line != _lines.end() && line->wl < min_wl ) ++ line;
+    int row_size = _row_bin.size();
 
-    // Iterate over lines, accumulating Sobolev opacity.  Neglect
-    // bins that have no opacity values exceeding the threshold.
+    bool tabulated = _temp_size > 1;
+    for( int j = 0; j < ion_size && tabulated; ++ j ) tabulated = temp[ j ] >= _temp_min && temp[ j ] <= _temp_max;
 
-    double tau_min = pow( 10.0, _log_tau_min );
-    while( line != _lines.end() && max_wl < _grid->max_wl )
+    // In incremental mode S, P and the opacity rows are kept from the
+    // previous Setup.  An ion's column of S changes only with its
+    // temperature, and its row of P only with its profile.  If few ions
+    // changed, only their columns and the rows with their lines are
+    // recomputed.  Otherwise everything is.
+
+    std::vector< int > changed;
+    bool full = _incremental == 0 || ions != _cache_ions || tabulated != _cache_tabulated;
+    for( int j = 0; j < ion_size && ! full; ++ j )
     {
-        if( line->wl < max_wl )
+        const double* prof = &profile[ j * v_size ];
+        if( temp[ j ] == _cache_temp[ j ] && std::equal( prof, prof + v_size, &_cache_profile[ j * v_size ] ) ) continue;
+        changed.push_back( j );
+        full = int( changed.size() ) > _incremental;
+    }
+
+    if( full )
+    {
+
+        _strength.assign( row_size * ion_size, 0.0 );
+        if( tabulated )
         {
-            ES::Line ref_line = _ref_lines[ line->ion ];
-            double str = line->wl * line->gf * exp( 11.604506 * ( ref_line.el - line->el ) / temp_map[ line->ion ] ) / 
-                ref_line.wl / ref_line.gf;
-            std::map< int, std::vector< double > >::iterator tau = tau_map.find( line->ion );
-            for( int iv = 0; iv < _grid->v_size; ++ iv ) _grid->tau[ offset + iv ] += tau->second[ iv ] * str;
-            ++ line;
+            for( int j = 0; j < ion_size; ++ j ) _ion_strength( j, ion_size, ions[ j ], temp[ j ], ref_lines[ j ], true );
         }
-        if( line->wl >= max_wl || line == _lines.end() )
+        else
         {
-            bool keep = false;
-            for( int iv = 0; iv < _grid->v_size; ++ iv ) 
+            #pragma omp parallel for
+            for( int r = 0; r < row_size; ++ r )
             {
-                if( _grid->tau[ offset + iv ] < tau_min ) continue;
-                keep = true;
-                break;
+                for( size_t l = _row_begin[ r ]; l < _row_end[ r ]; ++ l )
+                {
+                    if( _line_row[ l ] < 0 ) continue;
+                    const ES::Line& line     = _line_data[ l ];
+                    int             j        = column[ line.ion ];
+                    const ES::Line& ref_line = ref_lines[ j ];
+                    _strength[ r * ion_size + j ] += line.wl * line.gf * 
+                        exp( 11.604506 * ( ref_line.el - line.el ) / temp[ j ] ) / ref_line.wl / ref_line.gf;
+                }
             }
-            if( keep )
+        }
+
+        // Sobolev opacity of every row, before neglecting any.  Rows kept
+        // across incremental updates must round the same as the rows
+        // recomputed, so then every row is formed by _row_product and
+        // the opacity depends only on the Setup, not on the ones before.
+
+        _row_tau.assign( row_size * v_size, 0.0 );
+
+        if( row_size > 0 && ion_size > 0 )
+        {
+#ifdef HAVE_BLAS
+            if( _incremental == 0 )
             {
-                _grid->wl[ _grid->wl_used ] = 0.5 * ( min_wl + max_wl );
-                ++ _grid->wl_used;
-                offset += _grid->v_size;
+                char   no    = 'N';
+                double one   = 1.0;
+                double zero  = 0.0;
+                ES_DGEMM( &no, &no, &v_size, &row_size, &ion_size, &one, &profile[ 0 ], &v_size, &_strength[ 0 ], &ion_size, &zero, &_row_tau[ 0 ], &v_size );
             }
             else
+#endif
             {
-                for( int iv = 0; iv < _grid->v_size; ++ iv ) _grid->tau[ offset + iv ] = 0.0;
+                #pragma omp parallel for
+                for( int r = 0; r < row_size; ++ r ) _row_product( r, ion_size, profile );
             }
-            min_wl = max_wl;
-            max_wl *= factor;
         }
+
+        ++ _full_builds;
+
+    }
+    else if( ! changed.empty() )
+    {
+
+        std::vector< char > redo( row_size, 0 );
+        for( size_t c = 0; c < changed.size(); ++ c )
+        {
+            int j = changed[ c ];
+            if( temp[ j ] != _cache_temp[ j ] ) _ion_strength( j, ion_size, ions[ j ], temp[ j ], ref_lines[ j ], tabulated );
+            const std::vector< int >& rows = _ion_row[ ions[ j ] ];
+            for( size_t e = 0; e < rows.size(); ++ e ) redo[ rows[ e ] ] = 1;
+        }
+
+        int rows_built = 0;
+        #pragma omp parallel for reduction( + : rows_built )
+        for( int r = 0; r < row_size; ++ r )
+        {
+            if( ! redo[ r ] ) continue;
+            _row_product( r, ion_size, profile );
+            ++ rows_built;
+        }
+
+        ++ _incremental_builds;
+        _rows_built += rows_built;
+
     }
 
+    if( _incremental > 0 )
+    {
+        _cache_ions      = ions;
+        _cache_temp      = temp;
+        _cache_profile   = profile;
+        _cache_tabulated = tabulated;
+    }
+
+    // Neglect bins that have no opacity values exceeding the threshold,
+    // compacting the rest into the grid.  Each thread tests a block of
+    // rows and counts the ones it keeps.  A prefix sum over the counts
+    // then gives each block its place, and threads copy in parallel.
+
+    double tau_min = pow( 10.0, _log_tau_min );
+
+#ifdef _OPENMP
+    std::vector< int > offset( omp_get_max_threads() + 1, 0 );
+#else
+    std::vector< int > offset( 2, 0 );
+#endif
+    std::vector< char > keep( row_size );
+
+    #pragma omp parallel
+    {
+
+        int thread  = 0;
+        int threads = 1;
+#ifdef _OPENMP
+        thread  = omp_get_thread_num();
+        threads = omp_get_num_threads();
+#endif
+        int first = int( ( long long )( row_size ) * thread / threads );
+        int last  = int( ( long long )( row_size ) * ( thread + 1 ) / threads );
+
+        int count = 0;
+        for( int r = first; r < last; ++ r )
+        {
+            const double* tau = &_row_tau[ r * v_size ];
+            keep[ r ] = 0;
+            for( int iv = 0; iv < v_size; ++ iv ) 
+            {
+                if( tau[ iv ] < tau_min ) continue;
+                keep[ r ] = 1;
+                break;
+            }
+            count += keep[ r ];
+        }
+        offset[ thread + 1 ] = count;
+
+        #pragma omp barrier
+        #pragma omp single
+        {
+            for( int t = 0; t < threads; ++ t ) offset[ t + 1 ] += offset[ t ];
+            _grid->wl_used = offset[ threads ];
+        }
+
+        int used = offset[ thread ];
+        for( int r = first; r < last; ++ r )
+        {
+            if( ! keep[ r ] ) continue;
+            std::copy( &_row_tau[ r * v_size ], &_row_tau[ r * v_size ] + v_size, _grid->tau + used * v_size );
+            _grid->wl [ used ] = _row_wl [ r ];
+            _grid->bin[ used ] = _row_bin[ r ];
+            ++ used;
+        }
+
+    }
+
+    _grid->index();
+
+}
+
+void ES::Synow::Opacity::_ion_strength( int const j, int const ion_size, int const ion, double const temp, const ES::Line& ref_line, 
+        bool const tabulated )
+{
+
+    // Column j of S, for the rows with lines of the ion.
+
+    const std::vector< int >& rows = _ion_row[ ion ];
+    int e_size = rows.size();
+
+    if( tabulated )
+    {
+        double beta_min  = 1.0 / _temp_max;
+        double beta_step = ( 1.0 / _temp_min - beta_min ) / double( _temp_size - 1 );
+        double u = ( 1.0 / temp - beta_min ) / beta_step;
+        int    k = int( u );
+        if( k < 0              ) k = 0;
+        if( k > _temp_size - 2 ) k = _temp_size - 2;
+        double f = u - k;
+        const std::vector< double >& str = _ion_log_str[ ion ];
+        #pragma omp parallel for
+        for( int e = 0; e < e_size; ++ e )
+        {
+            const double* log_str = &str[ e * _temp_size + k ];
+            _strength[ rows[ e ] * ion_size + j ] = exp( log_str[ 0 ] + f * ( log_str[ 1 ] - log_str[ 0 ] ) );
+        }
+    }
+    else
+    {
+        #pragma omp parallel for
+        for( int e = 0; e < e_size; ++ e )
+        {
+            int    r   = rows[ e ];
+            double sum = 0.0;
+            for( size_t l = _row_begin[ r ]; l < _row_end[ r ]; ++ l )
+            {
+                const ES::Line& line = _line_data[ l ];
+                if( line.ion != ion ) continue;
+                sum += line.wl * line.gf * exp( 11.604506 * ( ref_line.el - line.el ) / temp ) / ref_line.wl / ref_line.gf;
+            }
+            _strength[ r * ion_size + j ] = sum;
+        }
+    }
+
+}
+
+void ES::Synow::Opacity::_row_product( int const r, int const ion_size, const std::vector< double >& profile )
+{
+    int     v_size = _grid->v_size;
+    double* tau    = &_row_tau[ r * v_size ];
+    std::fill( tau, tau + v_size, 0.0 );
+    for( int j = 0; j < ion_size; ++ j )
+    {
+        double str = _strength[ r * ion_size + j ];
+        if( str == 0.0 ) continue;
+        const double* prof = &profile[ j * v_size ];
+        for( int iv = 0; iv < v_size; ++ iv ) tau[ iv ] += str * prof[ iv ];
+    }
 }
 
 void ES::Synow::Opacity::_drop_ions( const ES::Synow::Setup& setup )
@@ -167,9 +534,11 @@ void ES::Synow::Opacity::_drop_ions( const ES::Synow::Setup& setup )
     for( size_t i = 0; i < ions.size(); ++ i ) _ref_lines.erase( ions[ i ] );
 
     // Remove ions from line list.  Erasure uses stable partitioning, so
-    // sorting the lines after dropping unwanted ions is not needed.
+    // sorting the lines after dropping unwanted ions is not needed.  A
+    // shared line list is left alone, indexing skips the ions instead.
 
-    drop( ions, _lines );
+    if( ! _shared ) drop( ions, _lines );
+    _indexed = false;
 
 }
 
@@ -198,41 +567,168 @@ void ES::Synow::Opacity::_load_ions( const ES::Synow::Setup& setup )
 
     // Load reference lines for new ions.
 
-    std::ifstream stream;
-    stream.open( _ref_file.c_str() );
-    if( ! stream.is_open() ) throw ES::Exception( "Unable to open reference line list file: '" + _ref_file + "'" );
+    std::vector< ES::Line > ref_lines;
+    if( _shared_refs.empty() )
+    {
+        read_refs( ions, ref_lines );
+    }
+    else
+    {
+        for( size_t i = 0; i < ions.size(); ++ i )
+        {
+            std::map< int, ES::Line >::iterator ref_line = _shared_refs.find( ions[ i ] );
+            if( ref_line == _shared_refs.end() )
+            {
+                std::stringstream ss;
+                ss << ions[ i ];
+                throw ES::Exception( "Unable to find ion in reference line list file: '" + ss.str() + "'" );
+            }
+            ref_lines.push_back( ref_line->second );
+        }
+    }
+    for( size_t i = 0; i < ref_lines.size(); ++ i ) _ref_lines[ ref_lines[ i ].ion ] = ref_lines[ i ];
 
-    for( size_t i = 0; i < ions.size(); ++ i )
+    // Load lines for new ions, merging them into the sorted line list,
+    // unless they are shared.
+
+    if( ! _shared ) load( ions, _lines );
+    _indexed = false;
+
+}
+
+void ES::Synow::Opacity::_index()
+{
+
+    // Lines in use.  Only lines of ions with reference lines contribute,
+    // which matters for a shared list holding other ions too.
+
+    _line_data = _shared ? _shared      : ( _lines.empty() ? 0 : &_lines[ 0 ] );
+    _line_size = _shared ? _shared_size : _lines.size();
+
+    // Per-ion bound on the reference line opacity profile, and the
+    // temperature range, for culling.  A zero profile bound marks ions
+    // that do not contribute, and an infinite one ions never culled.
+
+    int max_ion = _ref_lines.empty() ? 0 : _ref_lines.rbegin()->first;
+    std::vector< double > max_profile( max_ion + 1, 0.0 );
+    std::vector< double > min_temp   ( max_ion + 1, 0.0 );
+    std::vector< double > max_temp   ( max_ion + 1, 0.0 );
+    for( std::map< int, ES::Line >::iterator ref_line = _ref_lines.begin(); ref_line != _ref_lines.end(); ++ ref_line )
     {
-        int ion;
-        double wl, gf, el;
-        bool found = false;
-        while( ! stream.eof() )
+        int ion = ref_line->first;
+        std::map< int, ES::Synow::Opacity::Bound >::iterator bound = _bounds.find( ion );
+        max_profile[ ion ] = bound == _bounds.end() ? HUGE_VAL : bound->second.max_profile;
+        min_temp   [ ion ] = bound == _bounds.end() ? 0.0      : bound->second.min_temp;
+        max_temp   [ ion ] = bound == _bounds.end() ? 0.0      : bound->second.max_temp;
+    }
+
+    // Initialize the first bin limits, and step up to the first line in
+    // the bin.
+
+    double factor  = _grid->factor;
+    double min_wl  = _grid->min_wl;
+    double max_wl  = min_wl * factor;
+    int    n       = 0;
+    double tau_min = pow( 10.0, _log_tau_min );
+
+    _cache_ions.clear();
+
+    _line_row.assign( _line_size, -1 );
+    _row_wl.clear();
+    _row_bin.clear();
+    _row_begin.clear();
+    _row_end.clear();
+    _ion_total.clear();
+    _ion_kept.clear();
+
+    size_t l = 0;
+    while( l < _line_size && _line_data[ l ].wl < min_wl ) ++ l;
+
+    // Iterate over bins with lines.  The optical depth in a bin can be
+    // no more than the sum over its lines of line strength at the most
+    // favorable temperature times the profile bound.  Bins where that
+    // stays below the opacity threshold are never kept, so they get no
+    // row; the others get one.
+
+    while( l < _line_size && max_wl < _grid->max_wl )
+    {
+        if( _line_data[ l ].wl >= max_wl )
         {
-            stream >> ion;
-            stream >> wl;
-            stream >> gf;
-            stream >> el;
-            if( stream.eof() ) break;
-            if( ion != ions[ i ] ) continue;
-            found = true;
-            break;
+            min_wl = max_wl;
+            max_wl *= factor;
+            ++ n;
+            continue;
         }
-        if( ! found )
+
+        size_t first = l;
+        double bound = 0.0;
+        for( ; l < _line_size && _line_data[ l ].wl < max_wl; ++ l )
         {
-            std::stringstream ss;
-            ss << ions[ i ];
-            throw ES::Exception( "Unable to find ion in reference line list file: '" + ss.str() + "'" );
+            const ES::Line& line = _line_data[ l ];
+            if( line.ion > max_ion || max_profile[ line.ion ] == 0.0 ) continue;
+            ++ _ion_total[ line.ion ];
+            if( max_profile[ line.ion ] == HUGE_VAL )
+            {
+                bound = HUGE_VAL;
+                continue;
+            }
+            const ES::Line& ref_line = _ref_lines[ line.ion ];
+            double a = 11.604506 * ( ref_line.el - line.el );
+            bound += line.wl * line.gf * exp( a / ( a > 0.0 ? min_temp[ line.ion ] : max_temp[ line.ion ] ) ) / 
+                ref_line.wl / ref_line.gf * max_profile[ line.ion ];
+        }
+        if( bound == 0.0 || bound * ( 1.0 + 1.0e-6 ) < tau_min ) continue;
+
+        _row_wl.push_back( 0.5 * ( min_wl + max_wl ) );
+        _row_bin.push_back( n );
+        _row_begin.push_back( first );
+        _row_end.push_back( l );
+        for( size_t k = first; k < l; ++ k )
+        {
+            int ion = _line_data[ k ].ion;
+            if( ion > max_ion || max_profile[ ion ] == 0.0 ) continue;
+            _line_row[ k ] = _row_bin.size() - 1;
+            ++ _ion_kept[ ion ];
         }
-        _ref_lines[ ion ] = ES::Line( ion, wl, gf, el );
-        stream.clear();
-        stream.seekg( 0, std::ios::beg );
     }
-    stream.close();
 
-    // Load lines for new ions and re-sort line list.
+    // List the rows of each ion, and tabulate the log summed strength
+    // of its lines in each of them against temperature.  The Boltzmann
+    // factor of each line is stepped along the grid, which is uniform in
+    // 1 / temp, by multiplication.
+
+    _ion_row.clear();
+    _ion_log_str.clear();
+
+    double beta_min  = _temp_size > 1 ? 1.0 / _temp_max : 0.0;
+    double beta_step = _temp_size > 1 ? ( 1.0 / _temp_min - beta_min ) / double( _temp_size - 1 ) : 0.0;
+    for( l = 0; l < _line_size; ++ l )
+    {
+        if( _line_row[ l ] < 0 ) continue;
+        const ES::Line&     line = _line_data[ l ];
+        std::vector< int >& rows = _ion_row[ line.ion ];
+        bool new_row = rows.empty() || rows.back() != _line_row[ l ];
+        if( new_row ) rows.push_back( _line_row[ l ] );
+        if( _temp_size < 2 ) continue;
+        const ES::Line&        ref_line = _ref_lines[ line.ion ];
+        std::vector< double >& str      = _ion_log_str[ line.ion ];
+        if( new_row ) str.resize( str.size() + _temp_size, 0.0 );
+        double  a     = 11.604506 * ( ref_line.el - line.el );
+        double  c     = line.wl * line.gf / ref_line.wl / ref_line.gf;
+        double  boltz = exp( a * beta_min );
+        double  ratio = exp( a * beta_step );
+        double* s     = &str[ str.size() - _temp_size ];
+        for( int k = 0; k < _temp_size; ++ k )
+        {
+            s[ k ] += c * boltz;
+            boltz  *= ratio;
+        }
+    }
+    for( std::map< int, std::vector< double > >::iterator str = _ion_log_str.begin(); str != _ion_log_str.end(); ++ str )
+    {
+        for( size_t k = 0; k < str->second.size(); ++ k ) str->second[ k ] = log( std::max( str->second[ k ], 1.0e-300 ) );
+    }
 
-    load( ions, _lines );
-    std::sort( _lines.begin(), _lines.end() );
+    _indexed = true;
 
 }
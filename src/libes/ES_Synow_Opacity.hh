@@ -33,6 +33,7 @@
 
 #include <vector>
 #include <map>
+#include <iostream>
 
 namespace ES
 {
@@ -68,14 +69,114 @@ namespace ES
 
                 virtual void operator() ( const ES::Synow::Setup& setup );
 
+                /// Opacity depends on the ions and the velocity grid.
+
+                virtual unsigned depends() const;
+
+                /// Tabulate per-ion bin line strengths on temp_size points
+                /// between temp_min and temp_max in kK, uniform in 1 / temp.
+                /// Setups with all temperatures in range then interpolate the
+                /// tables instead of summing over lines.  Accuracy improves with
+                /// temp_size; fewer than 2 points disables the tables.
+
+                void tabulate( double const temp_min, double const temp_max, int const temp_size );
+
+                /// Read lines from an external list sorted by wavelength, such
+                /// as a node-level shared memory window, instead of loading
+                /// them.  The list must outlive the operator and hold the lines
+                /// of every ion a Setup activates; lines of other ions are
+                /// ignored.  A null list goes back to loading lines.
+
+                void share( const ES::Line* lines, size_t const line_size );
+
+                /// Read reference lines for a list of ions from the reference
+                /// line file, in the same order.
+
+                void read_refs( const std::vector< int >& ions, std::vector< ES::Line >& ref_lines ) const;
+
+                /// Take reference lines from a list, such as one read once and
+                /// broadcast, instead of reading the reference line file.
+
+                void share_refs( const std::vector< ES::Line >& ref_lines );
+
+                /// Neglect lines in bins that cannot reach the opacity threshold
+                /// for any Setup with parameters between those of lower and 
+                /// upper, which list the same ions.  Loads the lines of the ions
+                /// active in upper.  The bound on optical depth in a bin is the
+                /// sum over its lines of the strength at the most favorable
+                /// temperature times the largest reference line opacity, so
+                /// culled bins would have been neglected anyway.  Setups outside
+                /// the bounds may lose opacity.
+
+                void cull( const ES::Synow::Setup& lower, const ES::Synow::Setup& upper );
+
+                /// Write the number of lines kept and loaded for each ion.
+
+                void report( std::ostream& stream ) const;
+
+                /// Keep line strengths, profiles and opacity between Setups.
+                /// When up to max_changed ions differ in temperature or profile
+                /// from the previous Setup, only their strengths and the bins
+                /// with their lines are recomputed.  This costs about one more
+                /// bins x ions table, and full rebuilds no longer use BLAS, so
+                /// the opacity is bit for bit independent of earlier Setups.
+                /// Zero, the default, recomputes always.
+
+                void incremental( int const max_changed );
+
+                /// Write the number of full and incremental opacity rebuilds.
+
+                void report_builds( std::ostream& stream ) const;
+
             private :
 
+                /// Culling bounds for an ion.
+
+                struct Bound
+                {
+                    double max_profile;     ///< Largest reference line opacity.
+                    double min_temp;        ///< Lowest temperature in kK.
+                    double max_temp;        ///< Highest temperature in kK.
+                };
+
                 std::string                _ref_file;     ///< Path to reference line list file.
                 std::string                _form;         ///< Functional form of reference line opacity profile.
                 double                     _v_ref;        ///< Reference velocity in kkm/s for scaling reference line opacity profiles.
                 double                     _log_tau_min;  ///< Minimum Sobolev opacity to include a bin.
                 std::map< int, ES::Line >  _ref_lines;    ///< Reference lines.
+                std::map< int, ES::Line >  _shared_refs;  ///< Reference lines to take instead of reading the file.
                 std::vector< ES::Line >    _lines;        ///< List of loaded lines.
+                const ES::Line*            _shared;       ///< Shared line list, or null.
+                size_t                     _shared_size;  ///< Number of lines in shared line list.
+                const ES::Line*            _line_data;    ///< Lines in use, loaded or shared.
+                size_t                     _line_size;    ///< Number of lines in use.
+
+                double                     _temp_min;     ///< Lowest tabulated temperature in kK.
+                double                     _temp_max;     ///< Highest tabulated temperature in kK.
+                int                        _temp_size;    ///< Number of tabulated temperatures.
+                bool                       _indexed;      ///< If true, the tables below match the line list.
+                std::vector< int >         _line_row;     ///< Row of the strength matrix for each line, or -1.
+                std::vector< double >      _row_wl;       ///< Bin center wavelength of each row.
+                std::vector< int >         _row_bin;      ///< Bin lattice index of each row.
+                std::vector< size_t >      _row_begin;    ///< First line in the bin of each row.
+                std::vector< size_t >      _row_end;      ///< One past the last line in the bin of each row.
+                std::vector< double >      _row_tau;      ///< Sobolev opacity of each row, before neglecting bins.
+                std::vector< double >      _strength;     ///< Summed line strength per row and ion column, S.
+                std::map< int, std::vector< int > >    _ion_row;      ///< Rows with lines of each ion.
+                std::map< int, std::vector< double > > _ion_log_str;  ///< Log summed line strength per ion row and temperature.
+
+                std::map< int, Bound >     _bounds;       ///< Culling bounds per ion.
+                std::map< int, int >       _ion_total;    ///< Lines per ion in the grid wavelength range.
+                std::map< int, int >       _ion_kept;     ///< Lines per ion in bins with rows.
+
+                int                        _incremental;       ///< Most changed ions to rebuild incrementally, 0 for never.
+                std::vector< int >         _cache_ions;        ///< Ion of each column at the previous Setup, empty if invalid.
+                std::vector< double >      _cache_temp;        ///< Temperature of each column at the previous Setup.
+                std::vector< double >      _cache_profile;     ///< P at the previous Setup.
+                bool                       _cache_tabulated;   ///< If true, S was interpolated at the previous Setup.
+                long                       _full_builds;       ///< Number of full opacity rebuilds.
+                long                       _incremental_builds;///< Number of incremental opacity rebuilds.
+                long                       _rows_built;        ///< Number of rows recomputed incrementally.
 
                 /// Drop ions from the line list not needed by the Setup.
 
@@ -85,6 +186,20 @@ namespace ES
 
                 void _load_ions( const ES::Synow::Setup& setup );
 
+                /// Assign lines to rows of the strength matrix, and tabulate 
+                /// per-ion row strengths against temperature.
+
+                void _index();
+
+                /// Compute column j of S for an ion's rows.
+
+                void _ion_strength( int const j, int const ion_size, int const ion, double const temp, const ES::Line& ref_line, 
+                        bool const tabulated );
+
+                /// Compute row r of the opacity from S and P.
+
+                void _row_product( int const r, int const ion_size, const std::vector< double >& profile );
+
 
         };
 
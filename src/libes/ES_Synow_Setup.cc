@@ -57,6 +57,18 @@ bool ES::Synow::Setup::operator() ( const std::vector< double >& x )
     return false;
 }
 
+unsigned ES::Synow::Setup::diff( const ES::Synow::Setup& other ) const
+{
+    unsigned changed = 0;
+    if( a0 != other.a0 || a1 != other.a1 || a2 != other.a2 ) changed |= WARP;
+    if( v_phot != other.v_phot || v_outer != other.v_outer  ) changed |= VELOCITY;
+    if( t_phot != other.t_phot                              ) changed |= PHOTOSPHERE;
+    if( ions    != other.ions    || active != other.active || log_tau != other.log_tau || 
+        v_min   != other.v_min   || v_max  != other.v_max  || aux     != other.aux     ||
+        temp    != other.temp ) changed |= IONS;
+    return changed;
+}
+
 // bool ES::Setup::operator() ( lua::state& lua )
 // {
 //    int value = lua.next();
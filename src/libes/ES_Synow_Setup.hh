@@ -50,6 +50,16 @@ namespace ES
 
             public :         
 
+                /// Groups of fields, as bits in the mask returned by diff().
+
+                enum
+                {
+                    WARP        = 1 << 0,        ///< Spectral warping coefficients.
+                    VELOCITY    = 1 << 1,        ///< Photosphere and outer velocities.
+                    PHOTOSPHERE = 1 << 2,        ///< Photosphere temperature.
+                    IONS        = 1 << 3         ///< Ion table and per-ion opacity parameters.
+                };
+
                 /// Resize ion table and associated quantities.
 
                 void resize( int const num_ions );
@@ -58,6 +68,11 @@ namespace ES
 
                 bool operator() ( const std::vector< double >& x );
 
+                /// Returns a mask of the field groups that differ from
+                /// another Setup.
+
+                unsigned diff( const ES::Synow::Setup& other ) const;
+
                 std::vector< int  > ions;        ///< Ion code table.
                 std::vector< bool > active;      ///< Masks ions on or off.
 
@@ -29,6 +29,7 @@
 #include "ES_Synow_Grid.hh"
 #include "ES_Synow_Setup.hh"
 #include "ES_Blackbody.hh"
+#include "ES_Math.hh"
 
 #ifdef _OPENMP
 #include "omp.h"
@@ -38,14 +39,25 @@
 #include <iostream>
 #include <algorithm>
 
-ES::Synow::Source::Source( ES::Synow::Grid& grid, int const mu_size ) :
+ES::Synow::Source::Source( ES::Synow::Grid& grid, int const mu_size, bool const reference ) :
     ES::Synow::Operator( grid ),
-    _mu_size( mu_size )
+    _mu_size( mu_size ),
+    _reference( reference ),
+    _reach_max( 0 ),
+    _table_size( 0 ),
+    _il( 0 ),
+    _cl( 0 ),
+    _cu( 0 ),
+    _wc( 0 ),
+    _v_phot( -1.0 ),
+    _v_outer( -1.0 )
 {
     int v_size  = _grid->v_size;
     _mu    = new double [ v_size * _mu_size * 2 ];
     _dmu   = new double [ v_size * _mu_size * 2 ];
     _shift = new double [ v_size * _mu_size * 2 ];
+    _reach = new int    [ v_size * _mu_size * 2 ];
+    _done  = new int    [ _grid->wl_size ];
 }
 
 ES::Synow::Source::~Source()
@@ -53,6 +65,17 @@ ES::Synow::Source::~Source()
     delete [] _mu;
     delete [] _dmu;
     delete [] _shift;
+    delete [] _reach;
+    delete [] _done;
+    delete [] _il;
+    delete [] _cl;
+    delete [] _cu;
+    delete [] _wc;
+}
+
+unsigned ES::Synow::Source::depends() const
+{
+    return ES::Synow::Setup::IONS | ES::Synow::Setup::VELOCITY | ES::Synow::Setup::PHOTOSPHERE;
 }
 
 void ES::Synow::Source::operator() ( const ES::Synow::Setup& setup )
@@ -60,11 +83,155 @@ void ES::Synow::Source::operator() ( const ES::Synow::Setup& setup )
 
     // Local caching.
 
-    double v_phot  = setup.v_phot;
-    double v_outer = setup.v_outer;
-    double v_step  = _grid->v[ 1 ] - _grid->v[ 0 ];
-    int    v_size  = _grid->v_size;
-    int    wl_used = _grid->wl_used;
+    int    v_size   = _grid->v_size;
+    int    wl_used  = _grid->wl_used;
+    int    ray_size = v_size * _mu_size * 2;
+
+    // Ray geometry depends only on the velocity grid.
+
+    if( setup.v_phot != _v_phot || setup.v_outer != _v_outer ) _trace( setup.v_phot, setup.v_outer );
+
+    // Integration.  Wavelength bins are handed out to threads in order
+    // of increasing wavelength.  Bin iw only needs the source function
+    // in bluer bins inside its Doppler interaction window, so all rays
+    // at bin iw are swept redward through that window together, and a
+    // thread only waits when it reaches a bin that is still in flight.
+    // Many bins proceed at once this way --- the old approach forked a
+    // team per bin and could use at most v_size threads.
+
+    for( int iw = 0; iw < wl_used; ++ iw ) _done[ iw ] = 0;
+
+    int next = 0;
+
+    #pragma omp parallel
+    {
+
+        double* in = new double [ ray_size ];
+
+        while( true )
+        {
+
+            // Claim the next bin.
+
+            int iw;
+            #pragma omp critical( ES_Synow_Source_next )
+            iw = next ++;
+            if( iw >= wl_used ) break;
+
+            // Initialize intensities.
+
+            for( int i = 0; i < ray_size; ++ i )
+            {
+                in[ i ] = i % ( _mu_size * 2 ) < _mu_size ? (*_grid->bb)( _grid->wl[ iw ] * _shift[ i ] ) * pow( _shift[ i ], 3 ) : 0.0;
+            }
+
+            // Sweep all rays redward through the interaction window.  The
+            // lattice offset between bins indexes the ray geometry table.
+
+            int n     = _grid->bin[ iw ];
+            int first = _grid->lattice[ n > _reach_max ? n - _reach_max : 0 ];
+
+            for( int ib = first; ib < iw; ++ ib )
+            {
+
+                // Wait until the source function in bin ib is finished.
+
+                int done = 0;
+                while( ! done )
+                {
+                    #pragma omp flush
+                    done = _done[ ib ];
+                }
+
+                int k = n - _grid->bin[ ib ];
+                if( _reference )
+                {
+                    _advance_reference( k, _grid->tau + ib * v_size, _grid->src + ib * v_size, in );
+                }
+                else
+                {
+                    _advance( k, _grid->tau + ib * v_size, _grid->src + ib * v_size, in );
+                }
+
+            }
+
+            // Angle-average, then publish the finished bin.
+
+            for( int iv = 0; iv < v_size; ++ iv )
+            {
+                int offset = iv * _mu_size * 2;
+                for( int im = 0; im < _mu_size * 2; ++ im ) _grid->src[ iw * v_size + iv ] += in[ offset + im ] * _dmu[ offset + im ];
+                _grid->src[ iw * v_size + iv ] *= 0.5;
+            }
+
+            #pragma omp flush
+            _done[ iw ] = 1;
+            #pragma omp flush
+
+        }
+
+        delete [] in;
+
+    }
+
+}
+
+void ES::Synow::Source::_advance( int const k, const double* tau, const double* src, double* in ) const
+{
+
+    // Rays that do not reach lattice offset k have zero weights in the
+    // table, which makes the update an exact identity.  So this loop has
+    // no branches and, with the polynomial exponential, vectorizes over
+    // all rays (the opacity and source function reads become gathers).
+    // The compiler cannot prove that the gathers never alias the ray
+    // intensities, so say so.
+
+    int           ray_size = _grid->v_size * _mu_size * 2;
+    const int*    il = _il + ( k - 1 ) * ray_size;
+    const double* cl = _cl + ( k - 1 ) * ray_size;
+    const double* cu = _cu + ( k - 1 ) * ray_size;
+    double        wc = _wc[ k ];
+
+    #pragma omp simd
+    for( int i = 0; i < ray_size; ++ i )
+    {
+        double et = cl[ i ] * tau[ il[ i ] ] + cu[ i ] * tau[ il[ i ] + 1 ];
+        double ss = cl[ i ] * src[ il[ i ] ] + cu[ i ] * src[ il[ i ] + 1 ];
+        et = ES::Math::exp_neg( et );
+        in[ i ] = in[ i ] * et + ss * ( 1.0 - et ) * wc;
+    }
+
+}
+
+void ES::Synow::Source::_advance_reference( int const k, const double* tau, const double* src, double* in ) const
+{
+    int           ray_size = _grid->v_size * _mu_size * 2;
+    const int*    il = _il + ( k - 1 ) * ray_size;
+    const double* cl = _cl + ( k - 1 ) * ray_size;
+    double        wc = _wc[ k ];
+
+    for( int i = 0; i < ray_size; ++ i )
+    {
+        if( k > _reach[ i ] ) continue;
+        double cu = 1.0 - cl[ i ];
+        double et = cl[ i ] * tau[ il[ i ] ] + cu * tau[ il[ i ] + 1 ];
+        double ss = cl[ i ] * src[ il[ i ] ] + cu * src[ il[ i ] + 1 ];
+        et = exp( - et );
+        in[ i ] = in[ i ] * et + ss * ( 1.0 - et ) * wc;
+    }
+}
+
+void ES::Synow::Source::_trace( double const v_phot, double const v_outer )
+{
+
+    // Local caching.
+
+    double v_step   = _grid->v[ 1 ] - _grid->v[ 0 ];
+    int    v_size   = _grid->v_size;
+    int    ray_size = v_size * _mu_size * 2;
+
+    _v_phot  = v_phot;
+    _v_outer = v_outer;
 
     // Prepare the wavelength-independent source metadata.
 
@@ -107,51 +274,64 @@ void ES::Synow::Source::operator() ( const ES::Synow::Setup& setup )
 
     }
 
-    // Adjust photosphere SED table as needed.
+    // Bins bluer than a point by a lattice offset k lie along a ray
+    // inside the line-forming region for k up to the ray's reach.
+
+    double log_factor = log( _grid->factor );
 
+    _reach_max = 0;
+    for( int i = 0; i < ray_size; ++ i )
     {
-        double blue_wl = _grid->wl[ 0 ];
-        for( int i = 0; i < v_size * _mu_size; ++ i )
-        {
-            double shift_wl = _grid->wl[ 0 ] * _shift[ i ];
-            if( shift_wl < blue_wl ) blue_wl = shift_wl;
-        }
-        (*_grid->bb)( blue_wl );
+        _reach[ i ] = int( ceil( - log( _shift[ i ] ) / log_factor ) ) - 1;
+        if( _reach[ i ] < 0 ) _reach[ i ] = 0;
+        if( _reach[ i ] > _reach_max ) _reach_max = _reach[ i ];
     }
 
-    // Integration.
+    if( ray_size * _reach_max > _table_size )
+    {
+        delete [] _il;
+        delete [] _cl;
+        delete [] _cu;
+        delete [] _wc;
+        _table_size = ray_size * _reach_max;
+        _il = new int    [ _table_size ];
+        _cl = new double [ _table_size ];
+        _cu = new double [ _table_size ];
+        _wc = new double [ _reach_max + 1 ];
+    }
 
-    int      offset, im, i, start, ib, il, iu;
-    double   v, in, d, vd, cl, cu, et, ss;
+    // Tabulate the velocity interpolation index and weight where each
+    // ray crosses each lattice offset, and the wavelength-ratio cube that
+    // converts intensity between bins.
 
-    for( int iw = 0; iw < wl_used; ++ iw )
+    for( int k = 1; k <= _reach_max; ++ k )
     {
-        #pragma omp parallel for private( v, offset, im, i, in, start, ib, d, vd, il, iu, cl, cu, et, ss ) schedule( static, 1 )
+        double  ratio = pow( _grid->factor, k );
+        double  d     = ( ratio - 1.0 ) * 299.792;
+        int*    il    = _il + ( k - 1 ) * ray_size;
+        double* cl    = _cl + ( k - 1 ) * ray_size;
+        double* cu    = _cu + ( k - 1 ) * ray_size;
+        _wc[ k ] = 1.0 / ( ratio * ratio * ratio );
         for( int iv = 0; iv < v_size; ++ iv )
         {
-            v = _grid->v[ iv ];
-            offset = iv * _mu_size * 2;
-            for( im = 0; im < _mu_size * 2; ++ im )
+            double v = _grid->v[ iv ];
+            for( int im = 0; im < _mu_size * 2; ++ im )
             {
-                i  = offset + im;
-                in = im < _mu_size ? (*_grid->bb)( _grid->wl[ iw ] * _shift[ i ] ) * pow( _shift[ i ], 3 ) : 0.0;
-                start = std::upper_bound( _grid->wl, _grid->wl + wl_used, _grid->wl[ iw ] * _shift[ i ] ) - _grid->wl;
-                for( ib = start; ib < iw; ++ ib )
+                int i = iv * _mu_size * 2 + im;
+                if( k > _reach[ i ] )
                 {
-                    d  = ( _grid->wl[ iw ] / _grid->wl[ ib ] - 1.0 ) * 299.792;
-                    vd = sqrt( v * v + d * d - 2.0 * v * d * _mu[ i ] );
-                    il = int( ( vd - v_phot ) / v_step );
-                    iu = il + 1;
-                    cl = ( _grid->v[ iu ] - vd ) / v_step;
-                    cu = 1.0 - cl;
-                    et = cl * _grid->tau[ ib * v_size + il ] + cu * _grid->tau[ ib * v_size + iu ];
-                    ss = cl * _grid->src[ ib * v_size + il ] + cu * _grid->src[ ib * v_size + iu ];
-                    et = exp( - et );
-                    in = in * et + ss * ( 1.0 - et ) * pow( _grid->wl[ ib ] / _grid->wl[ iw ], 3 );
+                    il[ i ] = 0;
+                    cl[ i ] = 0.0;
+                    cu[ i ] = 0.0;
+                    continue;
                 }
-                _grid->src[ iw * v_size + iv ] += in * _dmu[ i ];
+                double vd = sqrt( v * v + d * d - 2.0 * v * d * _mu[ i ] );
+                il[ i ] = int( ( vd - v_phot ) / v_step );
+                if( il[ i ] < 0          ) il[ i ] = 0;
+                if( il[ i ] > v_size - 2 ) il[ i ] = v_size - 2;
+                cl[ i ] = ( _grid->v[ il[ i ] + 1 ] - vd ) / v_step;
+                cu[ i ] = 1.0 - cl[ i ];
             }
-            _grid->src[ iw * v_size + iv ] *= 0.5;
         }
     }
 
@@ -53,15 +53,21 @@ namespace ES
         /// performed using the familiar ray-tracing method --- not a Monte 
         /// Carlo calculation.  So, while it is faster it is not accurate 
         /// enough to be used for a radiative equilibrium calculation.
+        ///
+        /// Threads work on different wavelength bins concurrently, in a
+        /// wavefront running from blue to red.  A bin depends only on the
+        /// source functions of bluer bins within its Doppler interaction
+        /// window, and waits on those bins individually.
 
         class Source : public ES::Synow::Operator
         {
 
             public :
 
-                /// Constructor.
+                /// Constructor.  The scalar reference kernel can be selected
+                /// for validating the default vectorized kernel against it.
 
-                Source( ES::Synow::Grid& grid, int const mu_size );
+                Source( ES::Synow::Grid& grid, int const mu_size, bool const reference = false );
 
                 /// Destructor.
 
@@ -71,6 +77,10 @@ namespace ES
 
                 virtual void operator() ( const ES::Synow::Setup& setup );
 
+                /// Source functions depend on everything but the warp.
+
+                virtual unsigned depends() const;
+
             private :
 
                 // Note that the full compliment of angles at each point is 
@@ -81,9 +91,41 @@ namespace ES
                 // The resolution requirements are pretty lax here.
 
                 int      _mu_size;      ///< Number of angles subtending either sky or photosphere.
+                bool     _reference;    ///< If true, use the scalar reference kernel.
                 double*  _mu;           ///< List of angles as direction-cosines.
                 double*  _dmu;          ///< Step in direction-cosine units for integral.
                 double*  _shift;        ///< Minimum Doppler first-order Doppler shift along each ray.
+                int*     _done;         ///< Completion flag for each wavelength bin.
+
+                // Wavelength bins sit on a log-uniform lattice, so where a
+                // ray from one bin meets the resonance of a bluer bin depends
+                // only on the lattice offset between them.  The geometry
+                // table below is indexed by lattice offset and ray, and is
+                // rebuilt only when the velocity grid changes.
+
+                int      _reach_max;    ///< Largest lattice offset reached by any ray.
+                int      _table_size;   ///< Capacity of ray geometry table.
+                int*     _reach;        ///< Largest lattice offset along each ray inside the line-forming region.
+                int*     _il;           ///< Lower velocity index per lattice offset and ray.
+                double*  _cl;           ///< Lower velocity interpolation weight per lattice offset and ray.
+                double*  _cu;           ///< Upper velocity interpolation weight per lattice offset and ray.
+                double*  _wc;           ///< Cube of bin wavelength ratio per lattice offset.
+                double   _v_phot;       ///< Photospheric velocity the geometry table was built for.
+                double   _v_outer;      ///< Outer velocity the geometry table was built for.
+
+                /// Advance intensities along all rays across the bin at lattice
+                /// offset k (vectorized kernel).
+
+                void _advance( int const k, const double* tau, const double* src, double* in ) const;
+
+                /// Advance intensities along all rays across the bin at lattice
+                /// offset k (scalar reference kernel).
+
+                void _advance_reference( int const k, const double* tau, const double* src, double* in ) const;
+
+                /// Compute angles, shifts and the ray geometry table.
+
+                void _trace( double const v_phot, double const v_outer );
 
         };
 
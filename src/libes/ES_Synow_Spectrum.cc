@@ -30,9 +30,13 @@
 #include "ES_Synow_Grid.hh"
 #include "ES_Synow_Setup.hh"
 #include "ES_Blackbody.hh"
+#include "ES_Math.hh"
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
 
 #include <cmath>
-#include <algorithm>
 
 ES::Synow::Spectrum::Spectrum( ES::Synow::Grid& grid, ES::Spectrum& output, ES::Spectrum& reference, 
         int const p_size, bool const flatten ) :
@@ -41,7 +45,15 @@ ES::Synow::Spectrum::Spectrum( ES::Synow::Grid& grid, ES::Spectrum& output, ES::
     _reference( &reference ),
     _flatten( flatten ),
     _p_size( p_size ), 
-    _p_total( 5 * p_size )
+    _p_total( 5 * p_size ),
+    _core( 0 ),
+    _core_wl( 0 ),
+    _core_size( 0 ),
+    _t_phot( -1.0 ),
+    _v_phot( -1.0 ),
+    _flux( 0 ),
+    _monitor( 0 ),
+    _aborted( false )
 {
     _alloc( false );
 }
@@ -49,6 +61,9 @@ ES::Synow::Spectrum::Spectrum( ES::Synow::Grid& grid, ES::Spectrum& output, ES::
 ES::Synow::Spectrum::~Spectrum()
 {
     _clear();
+    delete [] _core;
+    delete [] _core_wl;
+    delete [] _flux;
 }
 
 void ES::Synow::Spectrum::operator() ( const ES::Synow::Setup& setup )
@@ -59,8 +74,8 @@ void ES::Synow::Spectrum::operator() ( const ES::Synow::Setup& setup )
     double v_phot  = setup.v_phot;
     double v_outer = setup.v_outer;
     double v_step  = _grid->v[ 1 ] - _grid->v[ 0 ];
+    double v_scale = 1.0 / v_step;
     int    v_size  = _grid->v_size;
-    int    wl_used = _grid->wl_used;
 
     // Set up impact parameters, resizing arrays if needed.
 
@@ -77,7 +92,8 @@ void ES::Synow::Spectrum::operator() ( const ES::Synow::Setup& setup )
 
     for( int ip = 0; ip < p_outer; ++ ip )
     {
-        _p[ ip ] = p_init + ip * p_step;
+        _p [ ip ] = p_init + ip * p_step;
+        _pp[ ip ] = _p[ ip ] * _p[ ip ];
         _max_shift[ ip ] = 1.0 + sqrt( v_outer * v_outer - _p[ ip ] * _p[ ip ] ) / 299.792;
         _min_shift[ ip ] = ip < _p_size ? 1.0 + sqrt( v_phot  * v_phot  - _p[ ip ] * _p[ ip ] ) / 299.792 : 1.0 / _max_shift[ ip ];
     }
@@ -88,68 +104,169 @@ void ES::Synow::Spectrum::operator() ( const ES::Synow::Setup& setup )
     for( int ip = 0; ip < _p_size; ++ ip ) norm += _p[ ip ] * p_step;
     norm = 1.0 / norm;
 
-    for( size_t iw = 0; iw < _output->size(); ++ iw )
+    // Photospheric intensities depend only on the photosphere and output
+    // wavelengths, so they are only recomputed when one of those changes.
+    // So is the reference continuum, which is needed only for flattening.
+
+    int out_size = _output->size();
+
+    bool fresh = setup.t_phot == _t_phot && setup.v_phot == _v_phot && out_size == _core_size;
+    for( int iw = 0; iw < out_size && fresh; ++ iw ) fresh = _output->wl( iw ) == _core_wl[ iw ];
+
+    if( ! fresh )
     {
-        int start = std::upper_bound( _grid->wl, _grid->wl + wl_used, _output->wl( iw ) * _min_shift[ _p_size ] ) - _grid->wl;
-        int stop  = std::upper_bound( _grid->wl, _grid->wl + wl_used, _output->wl( iw ) * _max_shift[ 0       ] ) - _grid->wl;
+        if( out_size != _core_size )
+        {
+            delete [] _core;
+            delete [] _core_wl;
+            delete [] _flux;
+            _core_size = out_size;
+            _core      = new double [ _core_size * _p_size ];
+            _core_wl   = new double [ _core_size ];
+            _flux      = new double [ _core_size ];
+        }
+        _t_phot = setup.t_phot;
+        _v_phot = setup.v_phot;
 
-        _reference->flux( iw ) = 0.0;
-        for( int ip = 0; ip < p_outer; ++ ip ) 
+        #pragma omp parallel for
+        for( int iw = 0; iw < out_size; ++ iw )
         {
-            if( ip < _p_size )
-            {
-                _in[ ip ] = (*_grid->bb)( _output->wl( iw ) * _min_shift[ ip ] ) * pow( _min_shift[ ip ], 3 );
-                _reference->flux( iw ) += _in[ ip ] * _p[ ip ] * p_step;
-            }
-            else
-            {
-                _in[ ip ] = 0.0;
-            }
+            _core_wl[ iw ] = _output->wl( iw );
+            double* core = _core + iw * _p_size;
+            for( int ip = 0; ip < _p_size; ++ ip ) core[ ip ] = (*_grid->bb)( _output->wl( iw ) * _min_shift[ ip ] ) * pow( _min_shift[ ip ], 3 );
+            if( ! _flatten ) continue;
+            _reference->flux( iw ) = 0.0;
+            for( int ip = 0; ip < _p_size; ++ ip ) _reference->flux( iw ) += core[ ip ] * _p[ ip ] * p_step;
+            _reference->flux( iw ) *= norm;
         }
-        _reference->flux( iw ) *= norm;
+    }
 
-        for( int ib = start; ib < stop; ++ ib )
+    // Output pixels are independent, so they are split across threads,
+    // each with its own specific intensity buffer.  Each is finished as
+    // soon as it is done, so a Monitor can stop the rest.
+
+    int stop_all = 0;
+
+    #pragma omp parallel
+    {
+
+        double* in = new double [ p_outer ];
+
+        #pragma omp for schedule( dynamic, 16 )
+        for( int iw = 0; iw < out_size; ++ iw )
         {
-            double zs = _grid->wl[ ib ] / _output->wl( iw );
-            int offset = ib * v_size;
-            for( int ip = 0; ip < p_outer; ++ ip )
+            #pragma omp flush
+            if( stop_all ) continue;
+
+            int start = _grid->upper( _output->wl( iw ) * _min_shift[ _p_size ] );
+            int stop  = _grid->upper( _output->wl( iw ) * _max_shift[ 0       ] );
+
+            for( int ip = 0; ip < _p_size;  ++ ip ) in[ ip ] = _core[ iw * _p_size + ip ];
+            for( int ip = _p_size; ip < p_outer; ++ ip ) in[ ip ] = 0.0;
+
+            for( int ib = start; ib < stop; ++ ib )
             {
-                if( zs < _min_shift[ ip ] ) continue;
-                if( zs > _max_shift[ ip ] ) continue;
+                double zs = _grid->wl[ ib ] / _output->wl( iw );
                 double z  = ( 1.0 - zs ) * 299.792;
-                double vv = sqrt( z * z + _p[ ip ] * _p[ ip ] );
-                int    il = int( ( vv - v_phot ) / v_step );
-                int    iu = il + 1;
-                double cl = ( _grid->v[ iu ] - vv ) / v_step;
-                double cu = 1.0 - cl;
-                double et = cl * _grid->tau[ offset + il ] + cu * _grid->tau[ offset + iu ];
-                double ss = cl * _grid->src[ offset + il ] + cu * _grid->src[ offset + iu ];
-                et = exp( - et );
-                _in[ ip ] = _in[ ip ] * et + ss * ( 1.0 - et ) * pow( zs, 3 );
+                double zz = z * z;
+                double wc = zs * zs * zs;
+
+                // Impact parameters with _min_shift <= zs <= _max_shift form
+                // one contiguous range [ pa, pb ).  Redward ( zs >= 1 ) rays
+                // must miss the photosphere disk in front of it and stay inside
+                // v_outer:  vv_phot^2 <= z^2 + p^2 <= v_outer^2.  Blueward rays
+                // must pass beside the photosphere, where the only bound is
+                // from the back of the envelope.  Solve for the bounds, then
+                // nudge them against the stored shifts so the range matches
+                // the per-ray tests exactly.
+
+                double lo, hi;
+                int    pa, pb;
+                if( zs >= 1.0 )
+                {
+                    lo = v_phot  * v_phot  - zz;
+                    hi = v_outer * v_outer - zz;
+                    pa = lo > 0.0 ? int( ceil( ( sqrt( lo ) - p_init ) / p_step ) ) : 0;
+                }
+                else
+                {
+                    double y = ( 1.0 / zs - 1.0 ) * 299.792;
+                    hi = v_outer * v_outer - y * y;
+                    pa = _p_size;
+                }
+                pb = hi > 0.0 ? int( floor( ( sqrt( hi ) - p_init ) / p_step ) ) + 1 : 0;
+                if( pa < 0       ) pa = 0;
+                if( pa > p_outer ) pa = p_outer;
+                if( pb > p_outer ) pb = p_outer;
+                if( pb < pa      ) pb = pa;
+                while( pa > 0       && zs >= _min_shift[ pa - 1 ] && zs <= _max_shift[ pa - 1 ] ) -- pa;
+                while( pa < pb      && ( zs < _min_shift[ pa ] || zs > _max_shift[ pa ] ) ) ++ pa;
+                while( pb < p_outer && zs >= _min_shift[ pb ] && zs <= _max_shift[ pb ] ) ++ pb;
+                while( pb > pa      && ( zs < _min_shift[ pb - 1 ] || zs > _max_shift[ pb - 1 ] ) ) -- pb;
+
+                const double* tau = _grid->tau + ib * v_size;
+                const double* src = _grid->src + ib * v_size;
+                const double* v   = _grid->v;
+
+                // Without -fno-math-errno (implied by -ffast-math) compilers keep
+                // the scalar sqrt() call, which stops this loop vectorizing.
+
+                #pragma omp simd
+                for( int ip = pa; ip < pb; ++ ip )
+                {
+                    double vv = sqrt( zz + _pp[ ip ] );
+                    int    il = int( ( vv - v_phot ) * v_scale );
+                    int    iu = il + 1;
+                    double cl = ( v[ iu ] - vv ) * v_scale;
+                    double cu = 1.0 - cl;
+                    double et = cl * tau[ il ] + cu * tau[ iu ];
+                    double ss = cl * src[ il ] + cu * src[ iu ];
+                    et = ES::Math::exp_neg( et );
+                    in[ ip ] = in[ ip ] * et + ss * ( 1.0 - et ) * wc;
+                }
+            }
+
+            _output->flux( iw ) = 0.0;
+            for( int ip = 0; ip < p_outer; ++ ip ) _output->flux( iw ) += in[ ip ] * _p[ ip ] * p_step;
+            _output->flux( iw ) *= norm;
+
+            _finish( iw, setup );
+            if( _monitor && (*_monitor)( iw, _output->flux( iw ) ) )
+            {
+                stop_all = 1;
+                #pragma omp flush
             }
+
         }
 
-        _output->flux( iw ) = 0.0;
-        for( int ip = 0; ip < p_outer; ++ ip ) _output->flux( iw ) += _in[ ip ] * _p[ ip ] * p_step;
-        _output->flux( iw ) *= norm;
+        delete [] in;
 
     }
 
-    // Conversion to F-lambda, application of warp, or flattening.
+    // The unwarped flux is incomplete, and so is the output.
 
-    for( size_t iw = 0; iw < _output->size(); ++ iw )
+    _aborted = stop_all;
+    if( _aborted ) _grid->invalidate();
+
+}
+
+void ES::Synow::Spectrum::update( const ES::Synow::Setup& setup, unsigned const changed )
+{
+
+    // The kept flux is only good for the output wavelengths it was
+    // computed at.
+
+    bool warp_only = ! ( changed & ~ES::Synow::Setup::WARP ) && int( _output->size() ) == _core_size;
+    for( int iw = 0; iw < _core_size && warp_only; ++ iw ) warp_only = _output->wl( iw ) == _core_wl[ iw ];
+
+    if( warp_only )
     {
-        if( _flatten )
-        {
-            _output->flux( iw ) /= _reference->flux( iw );
-        }
-        else
-        {
-            double ww = _output->wl( iw ) / 6500.0;
-            _output->flux( iw ) /= ww * ww;
-            ww -= 1.0;
-            _output->flux( iw ) *= setup.a0 + ww * ( setup.a1 + ww * setup.a2 );
-        }
+        _warp( setup );
+        _aborted = false;
+    }
+    else
+    {
+        (*this)( setup );
     }
 
 }
@@ -157,16 +274,41 @@ void ES::Synow::Spectrum::operator() ( const ES::Synow::Setup& setup )
 void ES::Synow::Spectrum::_alloc( bool const clear )
 {
     if( clear ) _clear();
-    _in        = new double [ _p_total ];
     _p         = new double [ _p_total ];
+    _pp        = new double [ _p_total ];
     _min_shift = new double [ _p_total ];
     _max_shift = new double [ _p_total ];
 }
 
+void ES::Synow::Spectrum::_finish( int const iw, const ES::Synow::Setup& setup )
+{
+    if( _flatten )
+    {
+        _output->flux( iw ) /= _reference->flux( iw );
+    }
+    else
+    {
+        double ww = _output->wl( iw ) / 6500.0;
+        _flux[ iw ] = _output->flux( iw ) / ( ww * ww );
+        ww -= 1.0;
+        _output->flux( iw ) = _flux[ iw ] * ( setup.a0 + ww * ( setup.a1 + ww * setup.a2 ) );
+    }
+}
+
+void ES::Synow::Spectrum::_warp( const ES::Synow::Setup& setup )
+{
+    if( _flatten ) return;
+    for( size_t iw = 0; iw < _output->size(); ++ iw )
+    {
+        double ww = _output->wl( iw ) / 6500.0 - 1.0;
+        _output->flux( iw ) = _flux[ iw ] * ( setup.a0 + ww * ( setup.a1 + ww * setup.a2 ) );
+    }
+}
+
 void ES::Synow::Spectrum::_clear()
 {
-    delete [] _in;
     delete [] _p;
+    delete [] _pp;
     delete [] _min_shift;
     delete [] _max_shift;
 }
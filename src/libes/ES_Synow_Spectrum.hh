@@ -56,6 +56,28 @@ namespace ES
 
             public :
 
+                /// @class Monitor
+                /// @brief Watches output pixels as they are finished.
+                ///
+                /// Pixels are finished by several threads at once and in no
+                /// particular order, so implementations must be thread-safe.
+
+                class Monitor
+                {
+
+                    public :
+
+                        /// Destructor.
+
+                        virtual ~Monitor() {}
+
+                        /// Called with each finished output pixel.  Return
+                        /// true to abort the rest of the execution.
+
+                        virtual bool operator() ( int const iw, double const flux ) = 0;
+
+                };
+
                 /// Constructor.
 
                 Spectrum( ES::Synow::Grid& grid, ES::Spectrum& output, ES::Spectrum& reference, int const p_size, bool const flatten );
@@ -68,6 +90,23 @@ namespace ES
 
                 virtual void operator() ( const ES::Synow::Setup& setup );
 
+                /// Execute a Setup on the unchanged Grid.  If only the warp
+                /// changed, it is re-applied to the unwarped flux kept from
+                /// the last full execution.
+
+                virtual void update( const ES::Synow::Setup& setup, unsigned const changed );
+
+                /// Attach a Monitor to later executions, or detach it with a
+                /// null pointer.  If it aborts an execution, the remaining
+                /// output pixels are left as they were and the Grid is
+                /// invalidated, so the next Setup runs in full.
+
+                void monitor( Monitor* monitor ) { _monitor = monitor; }
+
+                /// If true, the last execution was aborted by the Monitor.
+
+                bool aborted() const { return _aborted; }
+
             private :
 
                 ES::Spectrum*  _output;     ///< Synthetic spectrum object.
@@ -77,11 +116,21 @@ namespace ES
 
                 int      _p_size;           ///< Number of impact parameters subtending photosphere.
                 int      _p_total;          ///< Total number of impact parameters subtending line-forming region.
-                double*  _in;               ///< Specific intensities.
                 double*  _p;                ///< Impact parameters.
+                double*  _pp;               ///< Squared impact parameters.
                 double*  _min_shift;        ///< Minimum first-order Doppler shift along each impact parameter.
                 double*  _max_shift;        ///< Maximum first-order Doppler shift along each impact parameter.
 
+                double*  _core;             ///< Photospheric specific intensities per output pixel and impact parameter.
+                double*  _core_wl;          ///< Output wavelengths the photospheric intensities were computed for.
+                int      _core_size;        ///< Number of output pixels the photospheric intensities were computed for.
+                double   _t_phot;           ///< Photosphere temperature the photospheric intensities were computed for.
+                double   _v_phot;           ///< Photosphere velocity the photospheric intensities were computed for.
+                double*  _flux;             ///< Unwarped F-lambda flux per output pixel from the last execution.
+
+                Monitor* _monitor;          ///< Watches finished pixels, may be null.
+                bool     _aborted;          ///< If true, the last execution was aborted.
+
                 // Note the presence of the following _alloc() and _clear()
                 // pair of methods.  Unlike the other operators in this 
                 // namespace, we occasionally need to re-allocate some of 
@@ -100,6 +149,14 @@ namespace ES
 
                 void _clear();
 
+                /// Convert an output pixel to F-lambda, then warp or flatten it.
+
+                void _finish( int const iw, const ES::Synow::Setup& setup );
+
+                /// Apply the warp to the unwarped flux.
+
+                void _warp( const ES::Synow::Setup& setup );
+
         };
 
     }
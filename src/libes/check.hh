@@ -0,0 +1,198 @@
+//
+// File    : check.hh
+// ------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so.
+//
+
+// A small synthetic problem for the check programs run by "make check".
+// It needs no line data: lines and reference lines are made up from a
+// fixed seed and handed to the opacity operator directly.
+
+#ifndef ES__CHECK
+#define ES__CHECK
+
+#include "ES_Synow.hh"
+#include "ES_Spectrum.hh"
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+
+namespace ES
+{
+
+    namespace Check
+    {
+
+        /// Output wavelength range and sampling in AA.
+
+        const double min_wl  = 3000.0;
+        const double max_wl  = 7000.0;
+        const double wl_step = 10.0;
+
+        /// @class Random
+        /// @brief Uniform deviates in [0,1) from a fixed seed, the same on
+        /// every platform and rank.
+
+        class Random
+        {
+
+            public :
+
+                Random( unsigned long long const seed = 1 ) : _state( seed ) {}
+
+                double operator() ()
+                {
+                    _state = _state * 6364136223846793005ULL + 1442695040888963407ULL;
+                    return double( _state >> 11 ) / 9007199254740992.0;
+                }
+
+            private :
+
+                unsigned long long _state;
+
+        };
+
+        /// Ions of the synthetic problem.
+
+        inline std::vector< int > ions()
+        {
+            int codes[] = { 601, 801, 1201, 1401, 2001, 2601 };
+            return std::vector< int >( codes, codes + 6 );
+        }
+
+        /// Append line_size made up lines per ion between min and max in
+        /// AA, then sort the list by wavelength.
+
+        inline void lines( const std::vector< int >& ions, double const min, double const max, int const line_size,
+                std::vector< ES::Line >& lines )
+        {
+            Random random( 7 );
+            for( size_t i = 0; i < ions.size(); ++ i )
+            {
+                for( int l = 0; l < line_size; ++ l )
+                {
+                    double wl = min + ( max - min ) * random();
+                    double gf = pow( 10.0, -3.0 * random() );
+                    double el = 5.0 * random();
+                    lines.push_back( ES::Line( ions[ i ], wl, gf, el ) );
+                }
+            }
+            std::stable_sort( lines.begin(), lines.end() );
+        }
+
+        /// Reference lines for the ions.
+
+        inline std::vector< ES::Line > refs( const std::vector< int >& ions )
+        {
+            std::vector< ES::Line > refs;
+            for( size_t i = 0; i < ions.size(); ++ i ) refs.push_back( ES::Line( ions[ i ], 4000.0 + 400.0 * i, 1.0, 0.5 * i ) );
+            return refs;
+        }
+
+        /// A Setup with every ion active and well above threshold.
+
+        inline ES::Synow::Setup setup( const std::vector< int >& ions )
+        {
+            ES::Synow::Setup setup;
+            setup.resize( ions.size() );
+            setup.a0      = 1.0;
+            setup.a1      = 0.0;
+            setup.a2      = 0.0;
+            setup.v_phot  = 10.0;
+            setup.v_outer = 30.0;
+            setup.t_phot  = 12.0;
+            for( size_t i = 0; i < ions.size(); ++ i )
+            {
+                setup.ions   [ i ] = ions[ i ];
+                setup.active [ i ] = true;
+                setup.log_tau[ i ] = 0.5 + 0.2 * i;
+                setup.v_min  [ i ] = 10.0;
+                setup.v_max  [ i ] = 30.0;
+                setup.aux    [ i ] = 5.0;
+                setup.temp   [ i ] = 8.0 + i;
+            }
+            return setup;
+        }
+
+        /// @class Stack
+        /// @brief A Grid with opacity, source and spectrum operators, fed
+        /// the synthetic lines.  Opacity neglects bins below log_tau_min.
+
+        class Stack
+        {
+
+            public :
+
+                Stack( const std::vector< ES::Line >& lines, const std::vector< ES::Line >& refs, bool const scalar = false,
+                        double const log_tau_min = -2.0 ) :
+                    output   ( ES::Spectrum::create_from_range_and_step( min_wl, max_wl, wl_step ) ),
+                    reference( ES::Spectrum::create_from_spectrum( output ) ),
+                    grid     ( ES::Synow::Grid::create( min_wl, max_wl, 0.3, 40, 30.0 ) ),
+                    opacity  ( grid, ".", "refs.dat", "exp", 10.0, log_tau_min ),
+                    source   ( grid, 6, scalar ),
+                    spectrum ( grid, output, reference, 30, false )
+                {
+                    opacity.share( lines.empty() ? 0 : &lines[ 0 ], lines.size() );
+                    opacity.share_refs( refs );
+                }
+
+                ES::Spectrum        output;     ///< Synthetic spectrum.
+                ES::Spectrum        reference;  ///< Reference pseudo-continuum.
+                ES::Synow::Grid     grid;       ///< Grid the operators are attached to.
+                ES::Synow::Opacity  opacity;    ///< Opacity operator.
+                ES::Synow::Source   source;     ///< Source operator.
+                ES::Synow::Spectrum spectrum;   ///< Spectrum operator.
+
+        };
+
+        /// Largest flux difference between two spectra, relative to the
+        /// larger flux.
+
+        inline double difference( const ES::Spectrum& a, const ES::Spectrum& b )
+        {
+            double largest = 0.0;
+            for( size_t i = 0; i < a.size(); ++ i )
+            {
+                double scale = std::max( fabs( a.flux( i ) ), fabs( b.flux( i ) ) );
+                if( scale > 0.0 ) largest = std::max( largest, fabs( a.flux( i ) - b.flux( i ) ) / scale );
+            }
+            return largest;
+        }
+
+        /// Report a comparison, and return 1 if it failed.
+
+        inline int report( const char* name, double const value, double const tolerance )
+        {
+            bool failed = ! ( value <= tolerance );
+            std::cout << ( failed ? "FAIL: " : "PASS: " ) << name << " " << value << " (tolerance " << tolerance << ")" << std::endl;
+            return failed ? 1 : 0;
+        }
+
+    }
+
+}
+
+#endif
@@ -0,0 +1,111 @@
+//
+// File    : check_cull.cc
+// -----------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so.
+//
+
+// Checks that culling lines against bounds on the setup parameters
+// leaves the spectra of random setups within the bounds unchanged, bit
+// for bit, over a range of opacity thresholds and with and without
+// temperature tables.
+
+#include "check.hh"
+
+#include <sstream>
+
+// A setup with each parameter drawn between its values in lower and
+// upper.
+
+ES::Synow::Setup draw( const ES::Synow::Setup& lower, const ES::Synow::Setup& upper, ES::Check::Random& random )
+{
+    ES::Synow::Setup setup = lower;
+    setup.v_phot = lower.v_phot + ( upper.v_phot - lower.v_phot ) * random();
+    for( size_t i = 0; i < setup.ions.size(); ++ i )
+    {
+        setup.log_tau[ i ] = lower.log_tau[ i ] + ( upper.log_tau[ i ] - lower.log_tau[ i ] ) * random();
+        setup.v_min  [ i ] = lower.v_min  [ i ] + ( upper.v_min  [ i ] - lower.v_min  [ i ] ) * random();
+        setup.v_max  [ i ] = lower.v_max  [ i ] + ( upper.v_max  [ i ] - lower.v_max  [ i ] ) * random();
+        setup.aux    [ i ] = lower.aux    [ i ] + ( upper.aux    [ i ] - lower.aux    [ i ] ) * random();
+        setup.temp   [ i ] = lower.temp   [ i ] + ( upper.temp   [ i ] - lower.temp   [ i ] ) * random();
+    }
+    return setup;
+}
+
+int check( const std::vector< int >& ions, const std::vector< ES::Line >& lines, const std::vector< ES::Line >& refs,
+        double const log_tau_min, int const temp_size )
+{
+    ES::Synow::Setup lower = ES::Check::setup( ions );
+    ES::Synow::Setup upper = lower;
+    upper.v_phot += 2.0;
+    for( size_t i = 0; i < ions.size(); ++ i )
+    {
+        lower.log_tau[ i ] -= 1.0;
+        lower.v_max  [ i ] -= 6.0;
+        lower.aux    [ i ] -= 2.0;
+        lower.temp   [ i ] -= 2.0;
+        upper.v_min  [ i ] += 4.0;
+        upper.aux    [ i ] += 3.0;
+        upper.temp   [ i ] += 4.0;
+    }
+
+    ES::Check::Stack plain ( lines, refs, false, log_tau_min );
+    ES::Check::Stack culled( lines, refs, false, log_tau_min );
+    if( temp_size > 0 )
+    {
+        plain.opacity.tabulate ( 5.0, 25.0, temp_size );
+        culled.opacity.tabulate( 5.0, 25.0, temp_size );
+    }
+    culled.opacity.cull( lower, upper );
+    culled.opacity.report( std::cout );
+
+    ES::Check::Random random( 11 );
+    double largest = 0.0;
+    for( int k = 0; k < 12; ++ k )
+    {
+        ES::Synow::Setup setup = draw( lower, upper, random );
+        plain.grid ( setup );
+        culled.grid( setup );
+        largest = std::max( largest, ES::Check::difference( plain.output, culled.output ) );
+    }
+
+    std::stringstream name;
+    name << "culled and unculled opacity, log_tau_min " << log_tau_min << ( temp_size > 0 ? ", tabulated" : "" );
+    return ES::Check::report( name.str().c_str(), largest, 0.0 );
+}
+
+int main()
+{
+    std::vector< int >      ions = ES::Check::ions();
+    std::vector< ES::Line > refs = ES::Check::refs( ions );
+    std::vector< ES::Line > lines;
+    ES::Check::lines( ions, 2500.0, 8000.0, 400, lines );
+
+    int failed = 0;
+    for( int t = -2; t <= 2; t += 2 )
+    {
+        failed += check( ions, lines, refs, t, 0 );
+        failed += check( ions, lines, refs, t, 32 );
+    }
+    return failed;
+}
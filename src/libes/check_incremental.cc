@@ -0,0 +1,102 @@
+//
+// File    : check_incremental.cc
+// ------------------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so.
+//
+
+// Checks that incremental opacity updates over a sequence of setups,
+// most changing one ion parameter, give the same spectra bit for bit as
+// building each setup from scratch in the same mode.  Also checks them
+// against the default full rebuilds, which may use BLAS and round
+// differently.
+
+#include "check.hh"
+
+#include <string>
+
+// Advance the setup sequence by one step.
+
+void step( ES::Synow::Setup& setup, int const k )
+{
+    size_t i = k % setup.ions.size();
+    switch( k % 4 )
+    {
+        case 0 : setup.temp   [ i ] += 0.7;  break;
+        case 1 : setup.log_tau[ i ] -= 0.3;  break;
+        case 2 : setup.aux    [ i ] += 1.5;  break;
+        case 3 : setup.v_max  [ i ] -= 2.0;  break;
+    }
+    if( k == 9 ) setup.v_phot += 1.0;
+}
+
+int check( const char* name, const std::vector< int >& ions, const std::vector< ES::Line >& lines,
+        const std::vector< ES::Line >& refs, int const temp_size )
+{
+    ES::Check::Stack full( lines, refs );
+    ES::Check::Stack incremental( lines, refs );
+    incremental.opacity.incremental( 1 );
+    if( temp_size > 0 )
+    {
+        full.opacity.tabulate( 5.0, 25.0, temp_size );
+        incremental.opacity.tabulate( 5.0, 25.0, temp_size );
+    }
+
+    ES::Synow::Setup setup = ES::Check::setup( ions );
+    double from_scratch = 0.0;
+    double from_full    = 0.0;
+    for( int k = 0; k < 16; ++ k )
+    {
+        if( k > 0 ) step( setup, k );
+
+        ES::Check::Stack scratch( lines, refs );
+        scratch.opacity.incremental( 1 );
+        if( temp_size > 0 ) scratch.opacity.tabulate( 5.0, 25.0, temp_size );
+
+        full.grid( setup );
+        incremental.grid( setup );
+        scratch.grid( setup );
+        from_scratch = std::max( from_scratch, ES::Check::difference( scratch.output, incremental.output ) );
+        from_full    = std::max( from_full,    ES::Check::difference( full.output,    incremental.output ) );
+    }
+
+    incremental.opacity.report_builds( std::cout );
+    std::string label = name;
+    int failed = 0;
+    failed += ES::Check::report( ( label + ", against builds from scratch" ).c_str(), from_scratch, 0.0 );
+    failed += ES::Check::report( ( label + ", against full rebuilds" ).c_str(), from_full, 1.0e-12 );
+    return failed;
+}
+
+int main()
+{
+    std::vector< int >      ions = ES::Check::ions();
+    std::vector< ES::Line > refs = ES::Check::refs( ions );
+    std::vector< ES::Line > lines;
+    ES::Check::lines( ions, 2500.0, 8000.0, 400, lines );
+
+    int failed = 0;
+    failed += check( "incremental opacity", ions, lines, refs, 0 );
+    failed += check( "incremental opacity, tabulated", ions, lines, refs, 32 );
+    return failed;
+}
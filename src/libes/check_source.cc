@@ -0,0 +1,57 @@
+//
+// File    : check_source.cc
+// -------------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so.
+//
+
+
+// Checks the default vectorized Source kernel against the scalar
+// reference kernel on the synthetic problem.
+
+#include "check.hh"
+
+int main()
+{
+    std::vector< int >      ions = ES::Check::ions();
+    std::vector< ES::Line > refs = ES::Check::refs( ions );
+    std::vector< ES::Line > lines;
+    ES::Check::lines( ions, 2500.0, 8000.0, 400, lines );
+
+    ES::Check::Stack vector( lines, refs );
+    ES::Check::Stack scalar( lines, refs, true );
+
+    // Two setups, so the second one reuses the ray geometry of the first.
+
+    int failed = 0;
+    for( int k = 0; k < 2; ++ k )
+    {
+        ES::Synow::Setup setup = ES::Check::setup( ions );
+        setup.v_phot += 2.0 * k;
+        vector.grid( setup );
+        scalar.grid( setup );
+        failed += ES::Check::report( "vectorized and scalar source kernels", ES::Check::difference( vector.output, scalar.output ), 1.0e-12 );
+    }
+
+    return failed;
+}
@@ -0,0 +1,185 @@
+//
+// File    : check_store.cc
+// ------------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so.
+//
+
+// Checks the line store written by lineprep.  With "write", writes
+// made-up Kurucz FITS line files into a line directory.  Otherwise,
+// after lineprep has run on that directory, checks that lines loaded
+// from the store are the lines decoded from the FITS files, bit for
+// bit, and that a truncated store is rejected.  check_store.sh runs
+// both steps.
+//
+// usage: check_store line_dir [write]
+
+#include "check.hh"
+#include "ES_Exception.hh"
+#include "ES_LineManager.hh"
+
+#include <cfloat>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+
+#include <sys/stat.h>
+
+#include "fitsio.h"
+
+// Path of an ion's FITS line file.
+
+std::string fits_file( const std::string& line_dir, int const ion )
+{
+    std::stringstream ss;
+    ss << line_dir << "/line.kurucz." << std::setw( 4 ) << std::setfill( '0' ) << ion << ".fits";
+    return ss.str();
+}
+
+// Write packed line records for every ion, in no particular order, as
+// a binary table in the first extension.
+
+int write_fits( const std::string& line_dir, const std::vector< int >& ions )
+{
+    ES::Check::Random random( 5 );
+    double rlog = log( 1.0 + 1.0 / 2000000.0 );
+    for( size_t i = 0; i < ions.size(); ++ i )
+    {
+        std::vector< long long > records( 300 + 50 * i );
+        for( size_t r = 0; r < records.size(); ++ r )
+        {
+            long long i_wl = ( long long )( log( ( 1000.0 + 9000.0 * random() ) / 10.0 ) / rlog );
+            long long i_el = 16384 + ( long long )( 4000.0 * random() );
+            long long i_gf = 16384 - ( long long )( 5000.0 * random() );
+            records[ r ] = ( i_wl & 0xFFFFFFFFLL ) | ( ( i_el & 0xFFFFLL ) << 32 ) | ( ( i_gf & 0xFFFFLL ) << 48 );
+        }
+
+        std::string name = "!" + fits_file( line_dir, ions[ i ] );
+        char  ttype[] = "record";
+        char  tform[] = "1K";
+        char  tunit[] = "";
+        char* type    = ttype;
+        char* form    = tform;
+        char* unit    = tunit;
+
+        fitsfile* fits;
+        int status = 0;
+        fits_create_file( &fits, name.c_str(), &status );
+        fits_create_tbl( fits, BINARY_TBL, 0, 1, &type, &form, &unit, "LINES", &status );
+        fits_write_col( fits, TLONGLONG, 1, 1, 1, records.size(), &records[ 0 ], &status );
+        fits_close_file( fits, &status );
+        if( status != 0 )
+        {
+            std::cerr << "check_store: unable to write line list file: '" << name.substr( 1 ) << "'" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Compare lines loaded from the store with lines decoded from the FITS
+// files and sorted the way ES::LineManager::load does, in a window.
+
+int compare( const std::string& line_dir, const std::vector< int >& ions, double const min_wl, double const max_wl )
+{
+    ES::LineManager stored( line_dir, min_wl, max_wl );
+    std::vector< ES::Line > loaded;
+    stored.load( ions, loaded );
+
+    ES::LineManager decoder( line_dir, min_wl, max_wl );
+    std::vector< ES::Line > decoded;
+    for( size_t i = 0; i < ions.size(); ++ i )
+    {
+        size_t middle = decoded.size();
+        decoder.load_fits( ions[ i ], decoded );
+        std::sort( decoded.begin() + middle, decoded.end() );
+        std::inplace_merge( decoded.begin(), decoded.begin() + middle, decoded.end() );
+    }
+
+    size_t differ = loaded.size() == decoded.size() ? 0 : std::max( loaded.size(), decoded.size() );
+    for( size_t l = 0; l < loaded.size() && l < decoded.size(); ++ l )
+    {
+        const ES::Line& a = loaded[ l ];
+        const ES::Line& b = decoded[ l ];
+        if( a.ion != b.ion || a.wl != b.wl || a.gf != b.gf || a.el != b.el ) ++ differ;
+    }
+
+    std::stringstream name;
+    name << "stored and decoded lines between " << min_wl << " and " << max_wl << " AA, " << decoded.size() << " lines,";
+    return ES::Check::report( name.str().c_str(), differ, 0 );
+}
+
+// Copy the store without its last line record into a new line
+// directory, and expect loading from it to fail.
+
+int truncated( const std::string& line_dir, int const ion )
+{
+    std::string truncated_dir = line_dir + "/truncated";
+    mkdir( truncated_dir.c_str(), 0755 );
+
+    std::ifstream in( ES::LineManager::store_file( line_dir ).c_str(), std::ios::binary );
+    std::string bytes( ( std::istreambuf_iterator< char >( in ) ), std::istreambuf_iterator< char >() );
+    bytes.resize( bytes.size() - sizeof( ES::Line ) );
+    std::ofstream out( ES::LineManager::store_file( truncated_dir ).c_str(), std::ios::binary );
+    out.write( bytes.data(), bytes.size() );
+    out.close();
+
+    int rejected = 0;
+    try
+    {
+        ES::LineManager manager( truncated_dir, 0.0, DBL_MAX );
+        std::vector< ES::Line > lines;
+        manager.load( ion, lines );
+    }
+    catch( ES::Exception& )
+    {
+        rejected = 1;
+    }
+    return ES::Check::report( "truncated store rejected, missing", 1 - rejected, 0 );
+}
+
+int main( int argc, char* argv[] )
+{
+
+    if( argc < 2 )
+    {
+        std::cerr << "usage: check_store line_dir [write]" << std::endl;
+        return 137;
+    }
+
+    std::string        line_dir = argv[ 1 ];
+    std::vector< int > ions     = ES::Check::ions();
+
+    if( argc > 2 && std::string( argv[ 2 ] ) == "write" ) return write_fits( line_dir, ions );
+
+    int failed = 0;
+    failed += compare( line_dir, ions, 0.0, DBL_MAX );
+    failed += compare( line_dir, ions, ES::Check::min_wl, ES::Check::max_wl );
+    failed += compare( line_dir, std::vector< int >( ions.begin() + 2, ions.begin() + 4 ), 4000.0, 4500.0 );
+    failed += truncated( line_dir, ions.back() );
+    return failed;
+
+}
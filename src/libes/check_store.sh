@@ -0,0 +1,14 @@
+#!/bin/sh
+#
+# Builds a line store with lineprep from made-up FITS line files, and
+# checks lines loaded from it against the files.
+
+dir=check_store.dir
+rm -rf $dir
+mkdir $dir || exit 1
+
+./check_store $dir write && ./lineprep $dir && ./check_store $dir
+status=$?
+
+rm -rf $dir
+exit $status
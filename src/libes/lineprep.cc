@@ -0,0 +1,141 @@
+// 
+// File    : lineprep.cc
+// ---------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so. 
+//
+
+// Builds the line store that ES::LineManager maps in place of decoding
+// per-ion Kurucz FITS files.  Converts every line.kurucz.NNNN.fits file
+// in the line directory, or just the ions given.
+//
+// usage: lineprep line_dir [ion ...]
+
+#include "ES_Exception.hh"
+#include "ES_Line.hh"
+#include "ES_LineManager.hh"
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+#include <dirent.h>
+
+int main( int argc, char* argv[] )
+{
+
+    if( argc < 2 )
+    {
+        std::cerr << "usage: lineprep line_dir [ion ...]" << std::endl;
+        exit( 137 );
+    }
+
+    std::string line_dir = argv[ 1 ];
+
+    // Ions to convert.
+
+    std::vector< int > ions;
+    for( int i = 2; i < argc; ++ i ) ions.push_back( atoi( argv[ i ] ) );
+
+    if( ions.empty() )
+    {
+        DIR* dir = opendir( line_dir.c_str() );
+        if( ! dir )
+        {
+            std::cerr << "lineprep: unable to open line directory: '" << line_dir << "'" << std::endl;
+            exit( 137 );
+        }
+        while( struct dirent* entry = readdir( dir ) )
+        {
+            std::string name = entry->d_name;
+            if( name.size() != 21 || name.compare( 0, 12, "line.kurucz." ) != 0 || name.compare( 16, 5, ".fits" ) != 0 ) continue;
+            ions.push_back( atoi( name.substr( 12, 4 ).c_str() ) );
+        }
+        closedir( dir );
+    }
+
+    std::sort( ions.begin(), ions.end() );
+    ions.erase( std::unique( ions.begin(), ions.end() ), ions.end() );
+
+    // Decode each ion's lines at all wavelengths and sort them.  The line
+    // manager must be built before the store exists, or it maps it.
+
+    std::string file = ES::LineManager::store_file( line_dir );
+    std::remove( file.c_str() );
+
+    ES::LineManager manager( line_dir, 0.0, DBL_MAX );
+
+    std::vector< ES::Line >                  lines;
+    std::vector< ES::LineManager::StoreEntry > index( ions.size() );
+    for( size_t i = 0; i < ions.size(); ++ i )
+    {
+        size_t offset = lines.size();
+        try
+        {
+            manager.load_fits( ions[ i ], lines );
+        }
+        catch( ES::Exception& error )
+        {
+            std::cerr << "lineprep: " << error.what() << std::endl;
+            exit( 137 );
+        }
+        std::sort( lines.begin() + offset, lines.end() );
+        std::memset( &index[ i ], 0, sizeof( index[ i ] ) );
+        index[ i ].ion    = ions[ i ];
+        index[ i ].offset = offset;
+        index[ i ].size   = lines.size() - offset;
+        std::cerr << "lineprep: " << ions[ i ] << " " << index[ i ].size << " lines" << std::endl;
+    }
+
+    // Write header, ion index and line records.
+
+    ES::LineManager::StoreHeader header;
+    std::memset( &header, 0, sizeof( header ) );
+    std::strncpy( header.magic, "ESLINES", 8 );
+    header.version    = 1;
+    header.line_bytes = sizeof( ES::Line );
+    header.ion_size   = ions.size();
+
+    std::ofstream stream( file.c_str(), std::ios::binary );
+    if( ! stream.is_open() )
+    {
+        std::cerr << "lineprep: unable to open line store file: '" << file << "'" << std::endl;
+        exit( 137 );
+    }
+    stream.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+    if( ! index.empty() ) stream.write( reinterpret_cast< const char* >( &index[ 0 ] ), index.size() * sizeof( index[ 0 ] ) );
+    if( ! lines.empty() ) stream.write( reinterpret_cast< const char* >( &lines[ 0 ] ), lines.size() * sizeof( lines[ 0 ] ) );
+    stream.close();
+    if( stream.fail() )
+    {
+        std::cerr << "lineprep: unable to write line store file: '" << file << "'" << std::endl;
+        exit( 137 );
+    }
+
+    return 0;
+
+}
@@ -33,6 +33,8 @@
 #include <getopt.h>
 #include <cstdlib>
 #include <sstream>
+#include <map>
+#include <algorithm>
 
 void operator >> ( const YAML::Node& node, ES::Synow::Setup& setup )
 {
@@ -151,10 +153,96 @@ int main( int argc, char* argv[] )
             yaml[ "opacity" ][ "v_ref"       ],
             yaml[ "opacity" ][ "log_tau_min" ] );
 
-    // Source operator.
+    // Optionally tabulate line strengths against temperature, over the
+    // range of temperatures in the setups.
+
+    if( const YAML::Node* temp_size = yaml[ "opacity" ].FindValue( "temp_size" ) )
+    {
+        double temp_min = 0.0;
+        double temp_max = 0.0;
+        const YAML::Node& setups = yaml[ "setups" ];
+        for( YAML::Iterator iter = setups.begin(); iter != setups.end(); ++ iter )
+        {
+            ES::Synow::Setup setup;
+            *iter >> setup;
+            for( size_t i = 0; i < setup.temp.size(); ++ i )
+            {
+                if( ! setup.active[ i ] ) continue;
+                if( temp_max == 0.0 || setup.temp[ i ] < temp_min ) temp_min = setup.temp[ i ];
+                if( temp_max == 0.0 || setup.temp[ i ] > temp_max ) temp_max = setup.temp[ i ];
+            }
+        }
+        opacity.tabulate( temp_min, temp_max, *temp_size );
+    }
+
+    // Optionally cull lines that cannot reach the opacity threshold in
+    // any of the setups, bounding the parameters of each ion over all
+    // of them.
+
+    bool cull_lines = false;
+    if( const YAML::Node* cull = yaml[ "opacity" ].FindValue( "cull_lines" ) ) *cull >> cull_lines;
+    if( cull_lines )
+    {
+        ES::Synow::Setup     lower;
+        ES::Synow::Setup     upper;
+        std::map< int, int > index;
+        bool                 first = true;
+        const YAML::Node& setups = yaml[ "setups" ];
+        for( YAML::Iterator iter = setups.begin(); iter != setups.end(); ++ iter )
+        {
+            ES::Synow::Setup setup;
+            *iter >> setup;
+            lower.v_phot = first ? setup.v_phot : std::min( lower.v_phot, setup.v_phot );
+            first        = false;
+            for( size_t i = 0; i < setup.ions.size(); ++ i )
+            {
+                if( ! setup.active[ i ] ) continue;
+                std::map< int, int >::iterator j = index.find( setup.ions[ i ] );
+                if( j == index.end() )
+                {
+                    index[ setup.ions[ i ] ] = lower.ions.size();
+                    lower.ions.push_back( setup.ions[ i ] );
+                    lower.active.push_back( true );
+                    lower.log_tau.push_back( setup.log_tau[ i ] );
+                    lower.v_min.push_back( setup.v_min[ i ] );
+                    lower.aux.push_back( setup.aux[ i ] );
+                    lower.temp.push_back( setup.temp[ i ] );
+                    upper.ions.push_back( setup.ions[ i ] );
+                    upper.active.push_back( true );
+                    upper.log_tau.push_back( setup.log_tau[ i ] );
+                    upper.v_min.push_back( setup.v_min[ i ] );
+                    upper.aux.push_back( setup.aux[ i ] );
+                    upper.temp.push_back( setup.temp[ i ] );
+                    continue;
+                }
+                int k = j->second;
+                lower.log_tau[ k ] = std::min( lower.log_tau[ k ], setup.log_tau[ i ] );
+                lower.v_min  [ k ] = std::min( lower.v_min  [ k ], setup.v_min  [ i ] );
+                lower.aux    [ k ] = std::min( lower.aux    [ k ], setup.aux    [ i ] );
+                lower.temp   [ k ] = std::min( lower.temp   [ k ], setup.temp   [ i ] );
+                upper.log_tau[ k ] = std::max( upper.log_tau[ k ], setup.log_tau[ i ] );
+                upper.v_min  [ k ] = std::max( upper.v_min  [ k ], setup.v_min  [ i ] );
+                upper.aux    [ k ] = std::max( upper.aux    [ k ], setup.aux    [ i ] );
+                upper.temp   [ k ] = std::max( upper.temp   [ k ], setup.temp   [ i ] );
+            }
+        }
+        opacity.cull( lower, upper );
+        opacity.report( std::cerr );
+    }
+
+    // Optionally recompute opacity only for ions that change between
+    // consecutive setups.
+
+    if( const YAML::Node* incremental = yaml[ "opacity" ].FindValue( "incremental" ) ) opacity.incremental( *incremental );
+
+    // Source operator.  Optionally use the scalar reference kernel, to
+    // check the default vectorized one against it.
+
+    bool scalar = false;
+    if( const YAML::Node* kernel = yaml[ "source" ].FindValue( "reference" ) ) *kernel >> scalar;
 
     ES::Synow::Source source( grid,
-            yaml[ "source" ][ "mu_size" ] );
+            yaml[ "source" ][ "mu_size" ], scalar );
 
     // Spectrum operator.
 
@@ -177,5 +265,7 @@ int main( int argc, char* argv[] )
         std::cout << output << std::endl;
     }
 
+    if( verbose ) opacity.report_builds( std::cerr );
+
     return 0;
 }
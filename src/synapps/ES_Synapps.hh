@@ -30,5 +30,8 @@
 
 #include "ES_Synapps_Config.hh"
 #include "ES_Synapps_Evaluator.hh"
+#include "ES_Synapps_Executor.hh"
+#include "ES_Synapps_LineShare.hh"
+#include "ES_Synapps_ThreadExecutor.hh"
 
 #endif
@@ -29,13 +29,15 @@
 
 #include <appspack/APPSPACK_Float.hpp>
 #include <appspack/APPSPACK_Vector.hpp>
+#include <appspack/APPSPACK_Matrix.hpp>
 #include <appspack/APPSPACK_Parameter_List.hpp>
 
 #include <yaml-cpp/yaml.h>
 
 #include <set>
+#include <algorithm>
 
-ES::Synapps::Config::Config( const YAML::Node& config )
+ES::Synapps::Config::Config( const YAML::Node& config, bool const fit_warp, bool const reduce, bool const simple_decrease )
 {
 
     config[ "fit_file" ] >> fit_file;
@@ -48,13 +50,25 @@ ES::Synapps::Config::Config( const YAML::Node& config )
     params.sublist( "Solver" ).setParameter( "Use Random Order"     , true );
     params.sublist( "Solver" ).setParameter( "Use Projected Compass", true );
 
+    // By default the solver rejects a trial point that improves on its
+    // parent by less than a margin.  Thresholds and guesses made from the
+    // lowest score received would then run ahead of the solver.
+
+    if( simple_decrease ) params.sublist( "Solver" ).setParameter( "Sufficient Decrease Factor", 0.0 );
+
     int num_ions = 0;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         num_ions += config[ "active" ][ i ] ? 1 : 0;
     }
 
-    APPSPACK::Vector buffer( 6 + 5 * num_ions );
+    // The warp coefficients lead the search vector, unless the
+    // evaluator fits them itself.
+
+    int w = fit_warp ? 0 : 3;
+
+    APPSPACK::Vector buffer( w + 3 + 5 * num_ions );
+    APPSPACK::Vector initial, lower, upper, scaling;
 
     APPSPACK::Matrix ineq_matrix;
     APPSPACK::Matrix eq_matrix;
@@ -64,14 +78,17 @@ ES::Synapps::Config::Config( const YAML::Node& config )
 
     // Initial value.
 
-    buffer[ 0 ] = config[ "a0"      ][ "start" ];
-    buffer[ 1 ] = config[ "a1"      ][ "start" ];
-    buffer[ 2 ] = config[ "a2"      ][ "start" ];
-    buffer[ 3 ] = config[ "v_phot"  ][ "start" ];
-    buffer[ 4 ] = config[ "v_outer" ][ "start" ];
-    buffer[ 5 ] = config[ "t_phot"  ][ "start" ];
+    if( w > 0 )
+    {
+        buffer[ 0 ] = config[ "a0"      ][ "start" ];
+        buffer[ 1 ] = config[ "a1"      ][ "start" ];
+        buffer[ 2 ] = config[ "a2"      ][ "start" ];
+    }
+    buffer[ w + 0 ] = config[ "v_phot"  ][ "start" ];
+    buffer[ w + 1 ] = config[ "v_outer" ][ "start" ];
+    buffer[ w + 2 ] = config[ "t_phot"  ][ "start" ];
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
@@ -84,17 +101,21 @@ ES::Synapps::Config::Config( const YAML::Node& config )
     }
 
     params.sublist( "Solver" ).setParameter( "Initial X", buffer );
+    initial = buffer;
 
     // Lower boundary.
 
-    buffer[ 0 ] = config[ "a0"      ][ "lower" ];
-    buffer[ 1 ] = config[ "a1"      ][ "lower" ];
-    buffer[ 2 ] = config[ "a2"      ][ "lower" ];
-    buffer[ 3 ] = config[ "v_phot"  ][ "lower" ];
-    buffer[ 4 ] = config[ "v_outer" ][ "lower" ];
-    buffer[ 5 ] = config[ "t_phot"  ][ "lower" ];
+    if( w > 0 )
+    {
+        buffer[ 0 ] = config[ "a0"      ][ "lower" ];
+        buffer[ 1 ] = config[ "a1"      ][ "lower" ];
+        buffer[ 2 ] = config[ "a2"      ][ "lower" ];
+    }
+    buffer[ w + 0 ] = config[ "v_phot"  ][ "lower" ];
+    buffer[ w + 1 ] = config[ "v_outer" ][ "lower" ];
+    buffer[ w + 2 ] = config[ "t_phot"  ][ "lower" ];
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
@@ -107,17 +128,21 @@ ES::Synapps::Config::Config( const YAML::Node& config )
     }
 
     params.sublist( "Linear" ).setParameter( "Lower", buffer );
+    lower = buffer;
 
     // Upper boundary.
 
-    buffer[ 0 ] = config[ "a0"      ][ "upper" ];
-    buffer[ 1 ] = config[ "a1"      ][ "upper" ];
-    buffer[ 2 ] = config[ "a2"      ][ "upper" ];
-    buffer[ 3 ] = config[ "v_phot"  ][ "upper" ];
-    buffer[ 4 ] = config[ "v_outer" ][ "upper" ];
-    buffer[ 5 ] = config[ "t_phot"  ][ "upper" ];
+    if( w > 0 )
+    {
+        buffer[ 0 ] = config[ "a0"      ][ "upper" ];
+        buffer[ 1 ] = config[ "a1"      ][ "upper" ];
+        buffer[ 2 ] = config[ "a2"      ][ "upper" ];
+    }
+    buffer[ w + 0 ] = config[ "v_phot"  ][ "upper" ];
+    buffer[ w + 1 ] = config[ "v_outer" ][ "upper" ];
+    buffer[ w + 2 ] = config[ "t_phot"  ][ "upper" ];
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
@@ -130,17 +155,21 @@ ES::Synapps::Config::Config( const YAML::Node& config )
     }
 
     params.sublist( "Linear" ).setParameter( "Upper", buffer );
+    upper = buffer;
 
     // Parameter scalings.
 
-    buffer[ 0 ] = config[ "a0"      ][ "scale" ];
-    buffer[ 1 ] = config[ "a1"      ][ "scale" ];
-    buffer[ 2 ] = config[ "a2"      ][ "scale" ];
-    buffer[ 3 ] = config[ "v_phot"  ][ "scale" ];
-    buffer[ 4 ] = config[ "v_outer" ][ "scale" ];
-    buffer[ 5 ] = config[ "t_phot"  ][ "scale" ];
+    if( w > 0 )
+    {
+        buffer[ 0 ] = config[ "a0"      ][ "scale" ];
+        buffer[ 1 ] = config[ "a1"      ][ "scale" ];
+        buffer[ 2 ] = config[ "a2"      ][ "scale" ];
+    }
+    buffer[ w + 0 ] = config[ "v_phot"  ][ "scale" ];
+    buffer[ w + 1 ] = config[ "v_outer" ][ "scale" ];
+    buffer[ w + 2 ] = config[ "t_phot"  ][ "scale" ];
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
@@ -153,22 +182,23 @@ ES::Synapps::Config::Config( const YAML::Node& config )
     }
 
     params.sublist( "Linear" ).setParameter( "Scaling", buffer );
+    scaling = buffer;
 
     // Inequality bounds constraints: v_phot <= v_outer;
 
     buffer.zero();
-    buffer[ 3 ] = - 1.0;
-    buffer[ 4 ] =   1.0;
+    buffer[ w + 0 ] = - 1.0;
+    buffer[ w + 1 ] =   1.0;
     ineq_matrix.addRow( buffer );
 
     // Inequality bounds constraints: v_phot <= v_min.
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
         buffer.zero();
-        buffer[ 3 ] = - 1.0;
+        buffer[ w + 0 ] = - 1.0;
         buffer[ j + 1 * num_ions ] = 1.0;
         ineq_matrix.addRow( buffer );
         ++ j;
@@ -176,7 +206,7 @@ ES::Synapps::Config::Config( const YAML::Node& config )
 
     // Inequality bounds constraints: v_min <= v_max.
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
@@ -189,13 +219,13 @@ ES::Synapps::Config::Config( const YAML::Node& config )
 
     // Inequality bounds constraints: v_max <= v_outer.
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
         buffer.zero();
         buffer[ j + 2 * num_ions ] = - 1.0;
-        buffer[ 4 ] = 1.0;
+        buffer[ w + 1 ] = 1.0;
         ineq_matrix.addRow( buffer );
         ++ j;
     }
@@ -208,14 +238,14 @@ ES::Synapps::Config::Config( const YAML::Node& config )
 
     // Equality constraints: Detached/attached ions (attached: v_phot == v_min ).
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
         if( ! config[ "detach" ][ i ] )
         {
             buffer.zero();
-            buffer[ 3 ] = - 1.0;
+            buffer[ w + 0 ] = - 1.0;
             buffer[ j + 1 * num_ions ] = 1.0;
             eq_matrix.addRow( buffer );
             eq_bound.push_back( 0.0 );
@@ -227,14 +257,14 @@ ES::Synapps::Config::Config( const YAML::Node& config )
 
     std::set< int > done;
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
         if( done.find( config[ "ions" ][ i ] ) == done.end() )
         {
             int ion = config[ "ions" ][ i ];
-            int jj = 6;
+            int jj = w + 3;
             for( size_t ii = 0; ii < config[ "active" ].size(); ++ ii )
             {
                 if( ! config[ "active" ][ ii ] ) continue;
@@ -255,7 +285,7 @@ ES::Synapps::Config::Config( const YAML::Node& config )
 
     // Equality constraints: Any fixed individual parameters.
 
-    if( config[ "a0" ][ "fixed" ] )
+    if( w > 0 && config[ "a0" ][ "fixed" ] )
     {
         buffer.zero();
         buffer[ 0 ] = 1.0;
@@ -263,7 +293,7 @@ ES::Synapps::Config::Config( const YAML::Node& config )
         eq_bound.push_back( config[ "a0" ][ "start" ] );
     }
 
-    if( config[ "a1" ][ "fixed" ] )
+    if( w > 0 && config[ "a1" ][ "fixed" ] )
     {
         buffer.zero();
         buffer[ 1 ] = 1.0;
@@ -271,7 +301,7 @@ ES::Synapps::Config::Config( const YAML::Node& config )
         eq_bound.push_back( config[ "a1" ][ "start" ] );
     }
 
-    if( config[ "a2" ][ "fixed" ] )
+    if( w > 0 && config[ "a2" ][ "fixed" ] )
     {
         buffer.zero();
         buffer[ 2 ] = 1.0;
@@ -282,7 +312,7 @@ ES::Synapps::Config::Config( const YAML::Node& config )
     if( config[ "v_phot" ][ "fixed" ] )
     {
         buffer.zero();
-        buffer[ 3 ] = 1.0;
+        buffer[ w + 0 ] = 1.0;
         eq_matrix.addRow( buffer );
         eq_bound.push_back( config[ "v_phot" ][ "start" ] );
     }
@@ -290,7 +320,7 @@ ES::Synapps::Config::Config( const YAML::Node& config )
     if( config[ "v_outer" ][ "fixed" ] )
     {
         buffer.zero();
-        buffer[ 4 ] = 1.0;
+        buffer[ w + 1 ] = 1.0;
         eq_matrix.addRow( buffer );
         eq_bound.push_back( config[ "v_outer" ][ "start" ] );
     }
@@ -298,12 +328,12 @@ ES::Synapps::Config::Config( const YAML::Node& config )
     if( config[ "t_phot" ][ "fixed" ] )
     {
         buffer.zero();
-        buffer[ 5 ] = 1.0;
+        buffer[ w + 2 ] = 1.0;
         eq_matrix.addRow( buffer );
         eq_bound.push_back( config[ "t_phot" ][ "start" ] );
     }
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
@@ -317,7 +347,7 @@ ES::Synapps::Config::Config( const YAML::Node& config )
         ++ j;
     }
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
@@ -331,7 +361,7 @@ ES::Synapps::Config::Config( const YAML::Node& config )
         ++ j;
     }
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
@@ -345,7 +375,7 @@ ES::Synapps::Config::Config( const YAML::Node& config )
         ++ j;
     }
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
@@ -359,7 +389,7 @@ ES::Synapps::Config::Config( const YAML::Node& config )
         ++ j;
     }
 
-    j = 6;
+    j = w + 3;
     for( size_t i = 0; i < config[ "active" ].size(); ++ i )
     {
         if( ! config[ "active" ][ i ] ) continue;
@@ -373,9 +403,137 @@ ES::Synapps::Config::Config( const YAML::Node& config )
         ++ j;
     }
 
+    // Every parameter is searched as it is, unless reducing.
+
+    index.resize( buffer.size() );
+    value.assign( buffer.size(), 0.0 );
+    for( int k = 0; k < buffer.size(); ++ k ) index[ k ] = k;
+
+    if( reduce )
+    {
+        _reduce( initial, lower, upper, scaling, ineq_matrix, eq_matrix, eq_bound );
+        return;
+    }
+
     // Equality constraints.
 
     params.sublist( "Linear" ).setParameter( "Equality Matrix", eq_matrix );
     params.sublist( "Linear" ).setParameter( "Equality Bound" , eq_bound  );
 
 }
+
+void ES::Synapps::Config::_reduce( const APPSPACK::Vector& initial, const APPSPACK::Vector& lower, const APPSPACK::Vector& upper,
+        const APPSPACK::Vector& scaling, const APPSPACK::Matrix& ineq_matrix,
+        const APPSPACK::Matrix& eq_matrix, const APPSPACK::Vector& eq_bound )
+{
+
+    // Each equality constraint above either fixes one parameter, or ties
+    // two together.  Tied parameters form groups led by their first
+    // member.
+
+    int size = initial.size();
+
+    std::vector< int  > lead( size );
+    std::vector< bool > fixed( size, false );
+    for( int k = 0; k < size; ++ k ) lead[ k ] = k;
+
+    for( int r = 0; r < eq_matrix.getNrows(); ++ r )
+    {
+        const APPSPACK::Vector& row = eq_matrix.getRow( r );
+        std::vector< int > used;
+        for( int k = 0; k < size; ++ k ) if( row[ k ] != 0.0 ) used.push_back( k );
+        if( used.size() == 1 )
+        {
+            fixed[ used[ 0 ] ] = true;
+            value[ used[ 0 ] ] = eq_bound[ r ] / row[ used[ 0 ] ];
+        }
+        else
+        {
+            int a = used[ 0 ];
+            int b = used[ 1 ];
+            while( lead[ a ] != a ) a = lead[ a ];
+            while( lead[ b ] != b ) b = lead[ b ];
+            lead[ std::max( a, b ) ] = std::min( a, b );
+        }
+    }
+
+    // Members lead to smaller indices, so one pass in order takes each of
+    // them to the first member of its group.
+
+    for( int k = 0; k < size; ++ k ) lead[ k ] = lead[ lead[ k ] ];
+
+    // A group with a fixed member is fixed to the value of its first
+    // one.  Every other group is one search parameter, inside the bounds
+    // of all its members.  Groups are marked -1 if fixed and -2 until
+    // they are numbered.
+
+    std::vector< int > group( size, -2 );
+    for( int k = 0; k < size; ++ k )
+    {
+        if( ! fixed[ k ] || group[ lead[ k ] ] == -1 ) continue;
+        group[ lead[ k ] ] = -1;
+        value[ lead[ k ] ] = value[ k ];
+    }
+
+    APPSPACK::Vector start, low, high, scale;
+    for( int k = 0; k < size; ++ k )
+    {
+        int g = lead[ k ];
+        if( g == k && group[ g ] == -2 )
+        {
+            group[ g ] = start.size();
+            start.push_back( initial[ k ] );
+            low.push_back  ( lower  [ k ] );
+            high.push_back ( upper  [ k ] );
+            scale.push_back( scaling[ k ] );
+        }
+        index[ k ] = group[ g ];
+        if( index[ k ] < 0 )
+        {
+            value[ k ] = value[ g ];
+            continue;
+        }
+        low [ index[ k ] ] = std::max( low [ index[ k ] ], lower[ k ] );
+        high[ index[ k ] ] = std::min( high[ index[ k ] ], upper[ k ] );
+    }
+    for( int j = 0; j < start.size(); ++ j ) start[ j ] = std::min( std::max( start[ j ], low[ j ] ), high[ j ] );
+
+    params.sublist( "Solver" ).setParameter( "Initial X", start );
+    params.sublist( "Linear" ).setParameter( "Lower"    , low   );
+    params.sublist( "Linear" ).setParameter( "Upper"    , high  );
+    params.sublist( "Linear" ).setParameter( "Scaling"  , scale );
+
+    // Inequality constraints in the search parameters.  Fixed parameters
+    // move to the bound, and constraints left without search parameters
+    // are dropped.
+
+    APPSPACK::Matrix matrix;
+    APPSPACK::Vector bound;
+    for( int r = 0; r < ineq_matrix.getNrows(); ++ r )
+    {
+        const APPSPACK::Vector& row = ineq_matrix.getRow( r );
+        APPSPACK::Vector reduced( start.size(), 0.0 );
+        double           offset = 0.0;
+        bool             used   = false;
+        for( int k = 0; k < size; ++ k )
+        {
+            if( index[ k ] < 0 )
+            {
+                offset += row[ k ] * value[ k ];
+            }
+            else
+            {
+                reduced[ index[ k ] ] += row[ k ];
+            }
+        }
+        for( int j = 0; j < reduced.size(); ++ j ) used = used || reduced[ j ] != 0.0;
+        if( ! used ) continue;
+        matrix.addRow( reduced );
+        bound.push_back( - offset );
+    }
+
+    params.sublist( "Linear" ).setParameter( "Inequality Matrix", matrix );
+    params.sublist( "Linear" ).setParameter( "Inequality Lower" , bound );
+    params.sublist( "Linear" ).setParameter( "Inequality Upper" , APPSPACK::Vector( matrix.getNrows(), APPSPACK::dne() ) );
+
+}
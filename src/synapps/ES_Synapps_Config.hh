@@ -30,6 +30,8 @@
 
 #include <appspack/APPSPACK_Parameter_List.hpp>
 
+#include <vector>
+
 namespace YAML
 {
     class Node;
@@ -56,14 +58,33 @@ namespace ES
 
             public :
 
-                /// Constructor.
+                /// Constructor.  If fit_warp is true, the warp coefficients
+                /// are left out of the search vector.  If reduce is true, so
+                /// are fixed parameters, and parameters tied by equality
+                /// constraints are searched as one.  If simple_decrease is
+                /// true, the solver accepts any trial point that lowers the
+                /// best score, so the lowest score an executor has received
+                /// is the solver's best.
 
-                Config( const YAML::Node& yaml );
+                Config( const YAML::Node& yaml, bool const fit_warp = false, bool const reduce = false,
+                        bool const simple_decrease = false );
 
                 std::string fit_file;             ///< Document me.
 
                 APPSPACK::Parameter::List params; ///< APPSPACK parameter list.
 
+                std::vector< int >    index;      ///< Search vector index of each parameter, or -1 if it is fixed.
+                std::vector< double > value;      ///< Values of fixed parameters.
+
+            private :
+
+                /// Replace the equality constraints by searching only the
+                /// free parameters, one per tied group.
+
+                void _reduce( const APPSPACK::Vector& initial, const APPSPACK::Vector& lower, const APPSPACK::Vector& upper,
+                        const APPSPACK::Vector& scaling, const APPSPACK::Matrix& ineq_matrix,
+                        const APPSPACK::Matrix& eq_matrix, const APPSPACK::Vector& eq_bound );
+
         };
 
     }
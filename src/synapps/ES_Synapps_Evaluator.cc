@@ -25,6 +25,10 @@
 // perform publicly and display publicly, and to permit others to do so. 
 //
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include "ES_Synapps_Evaluator.hh"
 #include "ES_Synow.hh"
 
@@ -32,10 +36,19 @@
 
 #include <cmath>
 
+#ifdef F77_FUNC
+#define ES_DGELS F77_FUNC( dgels, DGELS )
+#else
+#define ES_DGELS dgels_
+#endif
+extern "C" void ES_DGELS( const char* trans, const int* m, const int* n, const int* nrhs, double* a, const int* lda,
+        double* b, const int* ldb, double* work, const int* lwork, int* info );
+
 ES::Synapps::Evaluator::Evaluator( ES::Synow::Grid& grid, ES::Spectrum& target, ES::Spectrum& output, const std::vector< int >& ions, 
         const std::vector< double >& region_weight, const std::vector< double >& region_lower, const std::vector< double >& region_upper, 
         double const vector_norm ) :
-    _grid( &grid ), _target( &target ), _output( &output ), _vector_norm( vector_norm )
+    _grid( &grid ), _target( &target ), _output( &output ), _vector_norm( vector_norm ), _fit_warp( false ),
+    _spectrum( 0 ), _threshold( HUGE_VAL ), _partial( 0.0 ), _bound( HUGE_VAL ), _evaluations( 0 ), _aborts( 0 )
 {
     _setup = new ES::Synow::Setup();
     _setup->resize( ions.size() );
@@ -71,8 +84,45 @@ ES::Synapps::Evaluator::Evaluator( ES::Synow::Grid& grid, ES::Spectrum& target,
 
 void ES::Synapps::Evaluator::operator() ( int tag, const APPSPACK::Vector& x, APPSPACK::Vector& f, std::string& msg )
 {
-    (*_setup)( x.getStlVector() );
-    (*_grid)( *_setup );
+    const std::vector< double >* point = &x.getStlVector();
+    if( ! _index.empty() )
+    {
+        _full.resize( _index.size() );
+        for( size_t k = 0; k < _index.size(); ++ k ) _full[ k ] = _index[ k ] < 0 ? _value[ k ] : x[ _index[ k ] ];
+        point = &_full;
+    }
+
+    if( _fit_warp )
+    {
+        _x.assign( _warp_start.begin(), _warp_start.end() );
+        _x.insert( _x.end(), point->begin(), point->end() );
+        (*_setup)( _x );
+        _solve_warp();
+    }
+    else if( _spectrum )
+    {
+        (*_setup)( *point );
+        _partial = 0.0;
+        _bound   = pow( _threshold, _vector_norm );
+        _spectrum->monitor( this );
+        (*_grid)( *_setup );
+        _spectrum->monitor( 0 );
+        ++ _evaluations;
+        if( _spectrum->aborted() )
+        {
+            ++ _aborts;
+            double score = pow( _partial, 1.0 / _vector_norm );
+            f.resize( 1 );
+            f[ 0 ] = score > _threshold ? score : HUGE_VAL;
+            msg = "Success";
+            return;
+        }
+    }
+    else
+    {
+        (*_setup)( *point );
+        (*_grid)( *_setup );
+    }
 
     double score = 0.0;
     for( size_t i = 0; i < _output->size(); ++ i )
@@ -86,3 +136,124 @@ void ES::Synapps::Evaluator::operator() ( int tag, const APPSPACK::Vector& x, AP
     f[ 0 ] = score;
     msg = "Success";
 }
+
+void ES::Synapps::Evaluator::fit_warp( const std::vector< double >& start, const std::vector< bool >& fixed )
+{
+    _fit_warp   = true;
+    _warp_start = start;
+    _warp_fixed = fixed;
+}
+
+void ES::Synapps::Evaluator::reduce( const std::vector< int >& index, const std::vector< double >& value )
+{
+    _index = index;
+    _value = value;
+}
+
+std::vector< double > ES::Synapps::Evaluator::warp() const
+{
+    std::vector< double > coefficients( 3 );
+    coefficients[ 0 ] = _setup->a0;
+    coefficients[ 1 ] = _setup->a1;
+    coefficients[ 2 ] = _setup->a2;
+    return coefficients;
+}
+
+void ES::Synapps::Evaluator::early_abort( ES::Synow::Spectrum& spectrum )
+{
+    _spectrum = &spectrum;
+}
+
+bool ES::Synapps::Evaluator::operator() ( int const iw, double const flux )
+{
+    if( _weight[ iw ] == 0.0 ) return false;
+    double term = pow( _weight[ iw ] * fabs( ( flux - _target->flux( iw ) ) / _target->flux_error( iw ) ), _vector_norm );
+    double partial;
+    #pragma omp critical( ES_Synapps_Evaluator_partial )
+    partial = _partial += term;
+    return partial > _bound;
+}
+
+void ES::Synapps::Evaluator::report( std::ostream& stream ) const
+{
+    stream << "early abort : " << _aborts << " of " << _evaluations << " evaluations" << std::endl;
+}
+
+void ES::Synapps::Evaluator::_solve_warp()
+{
+
+    // The warp is linear in its coefficients, so the synthetic spectra
+    // warped by each coefficient alone span all the warped ones.  Only
+    // the first of these runs the whole Grid, the others change just
+    // the warp and only re-apply it.
+
+    int     size = _output->size();
+    double* a[]  = { &_setup->a0, &_setup->a1, &_setup->a2 };
+
+    _basis.resize( 3 * size );
+    for( int k = 0; k < 3; ++ k )
+    {
+        for( int l = 0; l < 3; ++ l ) *a[ l ] = l == k ? 1.0 : 0.0;
+        (*_grid)( *_setup );
+        for( int i = 0; i < size; ++ i ) _basis[ k * size + i ] = _output->flux( i );
+    }
+
+    // Weighted least squares over the pixels in the objective, for the
+    // coefficients that are not fixed.
+
+    std::vector< int > unknown;
+    for( int k = 0; k < 3; ++ k )
+    {
+        *a[ k ] = _warp_start[ k ];
+        if( ! _warp_fixed[ k ] ) unknown.push_back( k );
+    }
+
+    std::vector< double > rhs;
+    for( int i = 0; i < size; ++ i )
+    {
+        if( _weight[ i ] == 0.0 ) continue;
+        double scale = _weight[ i ] / _target->flux_error( i );
+        double value = _target->flux( i );
+        for( int k = 0; k < 3; ++ k ) if( _warp_fixed[ k ] ) value -= _warp_start[ k ] * _basis[ k * size + i ];
+        rhs.push_back( scale * value );
+    }
+
+    int m = rhs.size();
+    int n = unknown.size();
+    if( n == 0 || m < n )
+    {
+        (*_grid)( *_setup );
+        return;
+    }
+
+    std::vector< double > design( m * n );
+    for( int c = 0; c < n; ++ c )
+    {
+        const double* basis = &_basis[ unknown[ c ] * size ];
+        int r = 0;
+        for( int i = 0; i < size; ++ i )
+        {
+            if( _weight[ i ] == 0.0 ) continue;
+            design[ c * m + r ] = _weight[ i ] / _target->flux_error( i ) * basis[ i ];
+            ++ r;
+        }
+    }
+
+    char   no    = 'N';
+    int    one   = 1;
+    int    info  = 0;
+    int    lwork = -1;
+    double query = 0.0;
+    ES_DGELS( &no, &m, &n, &one, &design[ 0 ], &m, &rhs[ 0 ], &m, &query, &lwork, &info );
+    lwork = int( query );
+    std::vector< double > work( lwork );
+    ES_DGELS( &no, &m, &n, &one, &design[ 0 ], &m, &rhs[ 0 ], &m, &work[ 0 ], &lwork, &info );
+
+    // A singular problem (no flux where it is weighted) keeps the start
+    // values.
+
+    if( info == 0 ) for( int c = 0; c < n; ++ c ) *a[ unknown[ c ] ] = rhs[ c ];
+
+    (*_grid)( *_setup );
+
+}
@@ -28,8 +28,13 @@
 #ifndef ES__SYNAPPS__EVALUATOR
 #define ES__SYNAPPS__EVALUATOR
 
+#include "ES_Synow_Spectrum.hh"
+
 #include <appspack/APPSPACK_Evaluator_Interface.hpp>
 
+#include <vector>
+#include <iostream>
+
 namespace APPSPACK
 {
     class Vector;
@@ -57,7 +62,7 @@ namespace ES
         /// @class Evaluator
         /// @brief Synow-style APPSPACK evaluator implementation.
 
-        class Evaluator : APPSPACK::Evaluator::Interface
+        class Evaluator : APPSPACK::Evaluator::Interface, public ES::Synow::Spectrum::Monitor
         {
 
             public :
@@ -79,6 +84,53 @@ namespace ES
 
                 virtual void print() const {}
 
+                /// Solve for the warp coefficients a0, a1, a2 in each
+                /// evaluation by weighted linear least squares, instead of
+                /// reading them from the trial point, which then omits
+                /// them.  Fixed coefficients keep their start values.  The
+                /// solution minimizes the objective for vector_norm 2 only,
+                /// and ignores the coefficient bounds.  It needs an
+                /// unflattened spectrum, which the warp acts on, and
+                /// takes precedence over early_abort.
+
+                void fit_warp( const std::vector< double >& start, const std::vector< bool >& fixed );
+
+                /// Read trial points that leave out fixed parameters and
+                /// search tied ones as one, see ES::Synapps::Config.  Each
+                /// parameter is the trial point entry at its index, or its
+                /// value if the index is -1.
+
+                void reduce( const std::vector< int >& index, const std::vector< double >& value );
+
+                /// Warp coefficients of the last evaluation.
+
+                std::vector< double > warp() const;
+
+                /// Watch the pixels the Spectrum operator finishes, and stop
+                /// an evaluation as soon as its partial score exceeds the
+                /// threshold.  The partial score is then reported instead,
+                /// or HUGE_VAL if rounding brought it down to the threshold.
+                /// Either way it is above the threshold, so a solver that
+                /// accepts only lower scores never takes it as long as the
+                /// threshold is no less than its best, see the simple_decrease
+                /// option of ES::Synapps::Config.
+
+                void early_abort( ES::Synow::Spectrum& spectrum );
+
+                /// Score threshold for the next evaluation, typically the
+                /// solver's best score so far.
+
+                void threshold( double const value ) { _threshold = value; }
+
+                /// Accumulates the score of a finished pixel, and returns
+                /// true if it exceeds the threshold.
+
+                virtual bool operator() ( int const iw, double const flux );
+
+                /// Report how many evaluations were stopped early.
+
+                void report( std::ostream& stream ) const;
+
             private :
 
                 ES::Synow::Setup*       _setup;         ///< Elementary supernova setup.
@@ -89,6 +141,27 @@ namespace ES
                 double                  _vector_norm;   ///< Norm between observed and synthesized spectrum.
                 std::vector< double >   _weight;        ///< Weight vector for objective function.
 
+                bool                    _fit_warp;      ///< If true, solve for the warp coefficients.
+                std::vector< double >   _warp_start;    ///< Start values of the warp coefficients.
+                std::vector< bool >     _warp_fixed;    ///< Masks warp coefficients out of the solution.
+                std::vector< double >   _x;             ///< Trial point with warp coefficients prepended.
+                std::vector< int >      _index;         ///< Trial point index of each parameter, empty if not reduced.
+                std::vector< double >   _value;         ///< Values of fixed parameters.
+                std::vector< double >   _full;          ///< Trial point with every parameter.
+                std::vector< double >   _basis;         ///< Synthetic spectrum for each warp coefficient alone.
+
+                ES::Synow::Spectrum*    _spectrum;      ///< Spectrum operator watched for early abort, may be null.
+                double                  _threshold;     ///< Score threshold for early abort.
+                double                  _partial;       ///< Partial score, raised to the vector norm.
+                double                  _bound;         ///< Threshold raised to the vector norm.
+                int                     _evaluations;   ///< Number of evaluations watched.
+                int                     _aborts;        ///< Number of evaluations stopped early.
+
+                /// Run the Grid once per warp coefficient, then solve for
+                /// the coefficients and run it again with them.
+
+                void _solve_warp();
+
         };
 
     }
@@ -0,0 +1,549 @@
+// 
+// File    : ES_Synapps_Executor.cc
+// --------------------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so. 
+//
+
+
+#include "ES_Synapps_Executor.hh"
+#include "ES_Synapps_Evaluator.hh"
+
+#include <appspack/APPSPACK_GCI.hpp>
+#include <appspack/APPSPACK_Executor_MPI.hpp>
+#include <appspack/APPSPACK_Constraints_Linear.hpp>
+
+#include <mpi.h>
+
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <map>
+
+// A batch is sent as an array of doubles: the number of trial points, the
+// best score, then the tag and coordinates of each trial point.  A batch
+// of no trial points terminates the worker.
+
+// Speculative trial points are computed differently from the solver's own,
+// so they only match up to rounding.
+
+static bool same( const APPSPACK::Vector& a, const APPSPACK::Vector& b )
+{
+    if( a.size() != b.size() ) return false;
+    for( int i = 0; i < a.size(); ++ i )
+    {
+        if( fabs( a[ i ] - b[ i ] ) > 1.0e-9 * ( 1.0 + fabs( a[ i ] ) ) ) return false;
+    }
+    return true;
+}
+
+ES::Synapps::Executor::Executor( const std::vector< int >& ranks, const std::vector< int >& batch_sizes ) :
+    _ranks( ranks ),
+    _busy( 0 ),
+    _best( HUGE_VAL ),
+    _count( 0 ),
+    _batches( 0 ),
+    _points( 0 ),
+    _linear( 0 ),
+    _level( 0 ),
+    _guess_tag( 0 ),
+    _guessed( 0 ),
+    _hits( 0 )
+{
+
+    for( size_t i = 0; i < _ranks.size(); ++ i )
+    {
+        if( _ranks[ i ] >= int( _batch_size.size() ) ) _batch_size.resize( _ranks[ i ] + 1, 1 );
+        _batch_size[ _ranks[ i ] ] = std::max( batch_sizes[ i ], 1 );
+    }
+
+    // Every worker gets a batch before any gets a second one.
+
+    for( int k = 0; k < 2; ++ k )
+    {
+        for( size_t i = _ranks.size(); i > 0; -- i ) _free.push_back( _ranks[ i - 1 ] );
+    }
+
+}
+
+bool ES::Synapps::Executor::isWaiting() const
+{
+    return ! _free.empty();
+}
+
+bool ES::Synapps::Executor::spawn( const APPSPACK::Vector& x, int tag )
+{
+    if( _linear && _claim( x, tag ) ) return true;
+    if( _free.empty() ) return false;
+
+    if( _linear )
+    {
+        _x[ tag ] = x;
+        _seen.push_back( x );
+
+        // Remember the step, unless it is a repeat.
+
+        if( _best_x.size() == x.size() )
+        {
+            APPSPACK::Vector step( x.size() );
+            for( int i = 0; i < x.size(); ++ i ) step[ i ] = x[ i ] - _best_x[ i ];
+            bool repeat = false;
+            for( size_t k = 0; k < _steps.size() && ! repeat; ++ k ) repeat = same( _steps[ k ], step );
+            if( ! repeat ) _steps.push_back( step );
+            if( int( _steps.size() ) > 2 * x.size() ) _steps.pop_front();
+        }
+    }
+
+    if( _count == 0 ) _batch.assign( 2, 0.0 );
+    _batch.push_back( tag );
+    for( int i = 0; i < x.size(); ++ i ) _batch.push_back( x[ i ] );
+    ++ _count;
+
+    if( _count == _batch_size[ _free.back() ] ) _send();
+    return true;
+}
+
+int ES::Synapps::Executor::recv( int& tag, APPSPACK::Vector& f, std::string& msg )
+{
+
+    // Do not hold trial points back waiting for a full batch.
+
+    if( _count > 0 ) _send();
+
+    if( _linear ) _fill();
+
+    // With every worker holding two batches a result must come, so wait
+    // for it.  Speculative results are kept, not returned.
+
+    while( _tag.empty() )
+    {
+        if( _busy == 0 ) return 0;
+        if( ! _free.empty() && ! APPSPACK::GCI::probe( APPSPACK::Executor::MPI::Feval ) ) return 0;
+        _receive();
+    }
+
+    int rank = _rank.front();
+    tag      = _tag.front();
+    f        = _f.front();
+    msg      = _msg.front();
+    _rank.pop_front();
+    _tag.pop_front();
+    _f.pop_front();
+    _msg.pop_front();
+    return rank;
+
+}
+
+void ES::Synapps::Executor::print() const
+{
+    std::cout << "ES::Synapps::Executor with " << _ranks.size() << " workers, " << _points << " points in " << _batches << " batches, best score sent " << _best << std::endl;
+    if( _linear ) std::cout << "speculative : " << _hits << " of " << _guessed << " points used" << std::endl;
+}
+
+void ES::Synapps::Executor::speculate( const APPSPACK::Constraints::Linear& linear )
+{
+    _linear = &linear;
+}
+
+void ES::Synapps::Executor::terminate()
+{
+    while( _busy > 0 ) _receive();
+
+    double done[] = { 0.0, 0.0 };
+    for( size_t i = 0; i < _ranks.size(); ++ i ) MPI_Send( done, 2, MPI_DOUBLE, _ranks[ i ], Batch, MPI_COMM_WORLD );
+}
+
+void ES::Synapps::Executor::work( ES::Synapps::Evaluator& evaluator, int const batch_size, bool const threshold, int const master )
+{
+    std::vector< double > current;
+    int x_size = _fetch( master, batch_size, current );
+    int size   = int( current[ 0 ] );
+    std::vector< double > next( current.size() );
+
+    APPSPACK::Vector x( x_size );
+    APPSPACK::Vector f;
+    std::string      msg;
+
+    while( size > 0 )
+    {
+
+        // Receive the next batch while this one is evaluated.
+
+        MPI_Request request;
+        MPI_Status  status;
+        MPI_Irecv( &next[ 0 ], int( next.size() ), MPI_DOUBLE, master, Batch, MPI_COMM_WORLD, &request );
+
+        if( threshold ) evaluator.threshold( current[ 1 ] );
+
+        // Evaluate the trial points in order.  Neighbors in a batch
+        // usually differ in a few parameters, so the Grid updates only
+        // what changed between them.
+
+        APPSPACK::GCI::initSend();
+        APPSPACK::GCI::pack( size );
+
+        const double* point = &current[ 2 ];
+        for( int k = 0; k < size; ++ k )
+        {
+            int tag = int( *point ++ );
+            for( int i = 0; i < x_size; ++ i ) x[ i ] = *point ++;
+            evaluator( tag, x, f, msg );
+            APPSPACK::GCI::pack( tag );
+            APPSPACK::GCI::pack( f   );
+            APPSPACK::GCI::pack( msg );
+        }
+
+        APPSPACK::GCI::send( APPSPACK::Executor::MPI::Feval, master );
+
+        MPI_Wait( &request, &status );
+        current.swap( next );
+        size = int( current[ 0 ] );
+
+    }
+
+}
+
+// Results of a batch a sub-master splits among its workers.
+
+namespace
+{
+    struct Reply
+    {
+        int                             remaining;  ///< Number of results still out.
+        std::vector< int >              tag;        ///< Tags of the results.
+        std::vector< APPSPACK::Vector > f;          ///< Results.
+        std::vector< std::string >      msg;        ///< Messages of the results.
+    };
+}
+
+void ES::Synapps::Executor::relay( int const batch_size, const std::vector< int >& ranks )
+{
+    int                   capacity = batch_size * int( ranks.size() );
+    std::vector< double > batch;
+    int                   x_size   = _fetch( 0, capacity, batch );
+
+    ES::Synapps::Executor local( ranks, std::vector< int >( ranks.size(), batch_size ) );
+
+    std::deque< int >              queue_tag;   // Trial points not yet sent to a worker.
+    std::deque< APPSPACK::Vector > queue_x;
+    std::map< int, int >           batch_of;    // Batch of each trial point out, by tag.
+    std::map< int, Reply >         replies;     // Batches with results still out.
+    int                            batches = 0;
+
+    while( true )
+    {
+
+        // Queue the trial points of a new batch.
+
+        int size = int( batch[ 0 ] );
+        if( size == 0 ) break;
+        local.threshold( batch[ 1 ] );
+
+        replies[ batches ].remaining = size;
+        const double* point = &batch[ 2 ];
+        for( int k = 0; k < size; ++ k )
+        {
+            int tag = int( *point ++ );
+            APPSPACK::Vector x( x_size );
+            for( int i = 0; i < x_size; ++ i ) x[ i ] = *point ++;
+            queue_tag.push_back( tag );
+            queue_x.push_back( x );
+            batch_of[ tag ] = batches;
+        }
+        ++ batches;
+
+        // Keep workers busy and return each batch to rank 0 once all its
+        // results are in, until rank 0 sends another batch.  The only
+        // place this waits is the probe, which wakes for either, so a
+        // batch from rank 0 is always received at once.
+
+        while( true )
+        {
+
+            while( ! queue_tag.empty() && local.isWaiting() )
+            {
+                local.spawn( queue_x.front(), queue_tag.front() );
+                queue_tag.pop_front();
+                queue_x.pop_front();
+            }
+
+            // Collect the results that are in.  Receiving only with a
+            // free worker or a reply pending never blocks.
+
+            int              tag;
+            APPSPACK::Vector f;
+            std::string      msg;
+            while( ( local.isWaiting() || APPSPACK::GCI::probe( APPSPACK::Executor::MPI::Feval ) ) && local.recv( tag, f, msg ) != 0 )
+            {
+                int    id    = batch_of[ tag ];
+                Reply& reply = replies[ id ];
+                batch_of.erase( tag );
+                reply.tag.push_back( tag );
+                reply.f.push_back( f );
+                reply.msg.push_back( msg );
+                if( -- reply.remaining > 0 ) continue;
+
+                APPSPACK::GCI::initSend();
+                APPSPACK::GCI::pack( int( reply.tag.size() ) );
+                for( size_t k = 0; k < reply.tag.size(); ++ k )
+                {
+                    APPSPACK::GCI::pack( reply.tag[ k ] );
+                    APPSPACK::GCI::pack( reply.f  [ k ] );
+                    APPSPACK::GCI::pack( reply.msg[ k ] );
+                }
+                APPSPACK::GCI::send( APPSPACK::Executor::MPI::Feval, 0 );
+                replies.erase( id );
+            }
+            if( ! queue_tag.empty() && local.isWaiting() ) continue;
+
+            MPI_Status status;
+            MPI_Probe( MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status );
+            if( status.MPI_TAG == Batch ) break;
+
+        }
+
+        int next = _fetch( 0, capacity, batch );
+        if( next > 0 ) x_size = next;
+
+    }
+
+    local.terminate();
+}
+
+void ES::Synapps::Executor::_send()
+{
+    int rank = _free.back();
+    _free.pop_back();
+
+    _batch[ 0 ] = _count;
+    _batch[ 1 ] = _best;
+    MPI_Send( &_batch[ 0 ], int( _batch.size() ), MPI_DOUBLE, rank, Batch, MPI_COMM_WORLD );
+
+    ++ _busy;
+    ++ _batches;
+    _points += _count;
+    _count = 0;
+}
+
+void ES::Synapps::Executor::_receive()
+{
+    int msg_tag, rank, size;
+    APPSPACK::GCI::recv( APPSPACK::Executor::MPI::Feval );
+    APPSPACK::GCI::bufinfo( msg_tag, rank );
+    APPSPACK::GCI::unpack( size );
+
+    for( int k = 0; k < size; ++ k )
+    {
+        int              tag;
+        APPSPACK::Vector f;
+        std::string      msg;
+        APPSPACK::GCI::unpack( tag );
+        APPSPACK::GCI::unpack( f   );
+        APPSPACK::GCI::unpack( msg );
+
+        // Keep the result of a speculative trial point until the solver
+        // asks for it.
+
+        if( tag < 0 )
+        {
+            std::map< int, int >::iterator wanted = _wanted.find( tag );
+            if( wanted == _wanted.end() )
+            {
+                _kept_x.push_back( _x[ tag ] );
+                _kept_f.push_back( f );
+                _kept_msg.push_back( msg );
+                _kept_rank.push_back( rank );
+                _x.erase( tag );
+                continue;
+            }
+            _x.erase( tag );
+            tag = wanted->second;
+            _wanted.erase( wanted );
+        }
+
+        _deliver( rank, tag, f, msg );
+    }
+
+    _free.push_back( rank );
+    -- _busy;
+}
+
+void ES::Synapps::Executor::_deliver( int const rank, int const tag, const APPSPACK::Vector& f, const std::string& msg )
+{
+
+    // Scores stopped early exceed the threshold they were sent, so they
+    // never lower the best.  With simple decrease, see ES::Synapps::Config,
+    // the solver accepts exactly the results that do.  Guesses around the old best point are
+    // of little use once it moves.
+
+    if( f.size() > 0 && f[ 0 ] < _best )
+    {
+        _best = f[ 0 ];
+        if( _linear )
+        {
+            _seen.clear();
+            if( _best_x.size() > 0 ) _seen.push_back( _best_x );
+            _best_x = _x[ tag ];
+            _seen.push_back( _best_x );
+            _level = 0;
+            _guesses.clear();
+            _kept_x.clear();
+            _kept_f.clear();
+            _kept_msg.clear();
+            _kept_rank.clear();
+        }
+    }
+    _x.erase( tag );
+
+    _rank.push_back( rank );
+    _tag.push_back( tag );
+    _f.push_back( f );
+    _msg.push_back( msg );
+
+}
+
+bool ES::Synapps::Executor::_claim( const APPSPACK::Vector& x, int const tag )
+{
+
+    // Already evaluated.
+
+    for( size_t k = 0; k < _kept_x.size(); ++ k )
+    {
+        if( ! same( _kept_x[ k ], x ) ) continue;
+        int              rank = _kept_rank[ k ];
+        APPSPACK::Vector f    = _kept_f[ k ];
+        std::string      msg  = _kept_msg[ k ];
+        _kept_x.erase( _kept_x.begin() + k );
+        _kept_f.erase( _kept_f.begin() + k );
+        _kept_msg.erase( _kept_msg.begin() + k );
+        _kept_rank.erase( _kept_rank.begin() + k );
+        _x[ tag ] = x;
+        _deliver( rank, tag, f, msg );
+        ++ _hits;
+        return true;
+    }
+
+    // Out with a worker.
+
+    for( std::map< int, APPSPACK::Vector >::iterator it = _x.begin(); it != _x.end() && it->first < 0; ++ it )
+    {
+        if( ! same( it->second, x ) || _wanted.count( it->first ) ) continue;
+        _wanted[ it->first ] = tag;
+        _x[ tag ] = x;
+        ++ _hits;
+        return true;
+    }
+
+    // Not sent yet, so send it as the solver's own.
+
+    for( size_t k = 0; k < _guesses.size(); ++ k )
+    {
+        if( ! same( _guesses[ k ], x ) ) continue;
+        _guesses.erase( _guesses.begin() + k );
+        break;
+    }
+
+    return false;
+
+}
+
+void ES::Synapps::Executor::_fill()
+{
+
+    // Only workers with no batch at all get speculative batches, so they
+    // do not hold up the solver's own trial points.  Such a worker is in
+    // the free list twice.
+
+    while( true )
+    {
+        size_t idle = 0;
+        while( idle < _free.size() && std::count( _free.begin(), _free.end(), _free[ idle ] ) < 2 ) ++ idle;
+        if( idle == _free.size() ) break;
+
+        if( _guesses.empty() ) _guess();
+        if( _guesses.empty() ) break;
+
+        std::swap( _free[ idle ], _free.back() );
+        _batch.assign( 2, 0.0 );
+        while( _count < _batch_size[ _free.back() ] && ! _guesses.empty() )
+        {
+            int tag = -- _guess_tag;
+            _x[ tag ] = _guesses.front();
+            _batch.push_back( tag );
+            for( int i = 0; i < _guesses.front().size(); ++ i ) _batch.push_back( _guesses.front()[ i ] );
+            _guesses.pop_front();
+            ++ _count;
+            ++ _guessed;
+        }
+        _send();
+    }
+
+}
+
+void ES::Synapps::Executor::_guess()
+{
+
+    // First the recent steps from the new best point, then the steps
+    // contracted by the solver's default factor of 1/2.
+
+    while( _guesses.empty() && _level < 3 && _best_x.size() > 0 )
+    {
+        double scale = pow( 0.5, _level ++ );
+        for( size_t k = 0; k < _steps.size(); ++ k )
+        {
+            APPSPACK::Vector x( _best_x.size() );
+            for( int i = 0; i < x.size(); ++ i ) x[ i ] = _best_x[ i ] + scale * _steps[ k ][ i ];
+            if( ! _linear->isFeasible( x ) ) continue;
+
+            bool repeat = false;
+            for( size_t j = 0; j < _seen.size() && ! repeat; ++ j ) repeat = same( _seen[ j ], x );
+            if( repeat ) continue;
+
+            _seen.push_back( x );
+            _guesses.push_back( x );
+        }
+    }
+
+}
+
+int ES::Synapps::Executor::_fetch( int const master, int const capacity, std::vector< double >& batch )
+{
+
+    // A batch has at least one trial point, unless it terminates the
+    // receiver.
+
+    MPI_Status status;
+    int        count;
+    MPI_Probe( master, Batch, MPI_COMM_WORLD, &status );
+    MPI_Get_count( &status, MPI_DOUBLE, &count );
+
+    batch.resize( count );
+    MPI_Recv( &batch[ 0 ], count, MPI_DOUBLE, master, Batch, MPI_COMM_WORLD, &status );
+
+    int size   = int( batch[ 0 ] );
+    int x_size = size > 0 ? ( count - 2 ) / size - 1 : 0;
+
+    batch.resize( 2 + std::max( capacity, 1 ) * ( x_size + 1 ) );
+    return x_size;
+
+}
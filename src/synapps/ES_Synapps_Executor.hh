@@ -0,0 +1,223 @@
+// 
+// File    : ES_Synapps_Executor.hh
+// --------------------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so. 
+//
+
+
+#ifndef ES__SYNAPPS__EXECUTOR
+#define ES__SYNAPPS__EXECUTOR
+
+#include <appspack/APPSPACK_Executor_Interface.hpp>
+#include <appspack/APPSPACK_Vector.hpp>
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+
+namespace APPSPACK
+{
+    namespace Constraints
+    {
+        class Linear;
+    }
+}
+
+namespace ES
+{
+
+    namespace Synapps
+    {
+
+        class Evaluator;
+
+        /// @class Executor
+        /// @brief MPI executor that sends workers batches of trial points.
+        ///
+        /// Works like APPSPACK::Executor::MPI, but ships up to batch_size
+        /// trial points per message along
+        /// with the smallest score received so far.  That is the solver's
+        /// best score when it runs with simple decrease, see
+        /// ES::Synapps::Config.  Workers evaluate a
+        /// batch back to back, unpack the score as a threshold if they stop
+        /// evaluations early, and reply with all the results at once.  Each
+        /// worker is given a second batch while it works on the first, so
+        /// it never waits on the master between batches.
+        ///
+        /// Trial points go out as plain arrays of doubles, so that workers
+        /// can receive the next batch without blocking.  Results come back
+        /// through APPSPACK::GCI.
+        ///
+        /// A sub-master relays batches to workers of its own and looks like
+        /// one big worker to its master, so ranks can be arranged in a tree
+        /// and the master only talks to a few of them.
+        ///
+        /// Optionally, workers the solver leaves idle evaluate speculative
+        /// trial points.  These are the recent steps taken from the best
+        /// point, then the same steps contracted.  The best point is the
+        /// one with the smallest score received, which the solver polls
+        /// from next only if it runs with simple decrease.  Their results are kept,
+        /// and a later trial point that matches one is answered at once.
+
+        class Executor : public APPSPACK::Executor::Interface
+        {
+
+            public :
+
+                /// Message tag of batches.  It differs from the APPSPACK
+                /// tags, which the results come back with.
+
+                enum { Batch = 1000 };
+
+                /// Constructor.  Serve the given ranks, with up to the
+                /// given number of trial points per batch for each.
+
+                Executor( const std::vector< int >& ranks, const std::vector< int >& batch_sizes );
+
+                /// Returns true if a worker can take more trial points.
+
+                virtual bool isWaiting() const;
+
+                /// Add a trial point to the next batch, and send it to a
+                /// worker once it is full.
+
+                virtual bool spawn( const APPSPACK::Vector& x, int tag );
+
+                /// Return a result, if there is one, and the rank that sent
+                /// it (0 if none).  Sends out a partly filled batch first,
+                /// and blocks if every worker has two batches.
+
+                virtual int recv( int& tag, APPSPACK::Vector& f, std::string& msg );
+
+                /// Prints information about the executor object.
+
+                virtual void print() const;
+
+                /// Fill idle workers with speculative trial points that
+                /// satisfy the given constraints.
+
+                void speculate( const APPSPACK::Constraints::Linear& linear );
+
+                /// Send the given score with batches while it is smaller
+                /// than any received, as a sub-master passes on the best
+                /// score its master sent.
+
+                void threshold( double const score ) { if( score < _best ) _best = score; }
+
+                /// Collect the batches still out, then terminate workers.
+
+                void terminate();
+
+                /// Worker side.  Evaluate the batches the master rank sends
+                /// until it terminates the worker.  If threshold is true, set
+                /// the evaluator threshold to the score sent with each batch.
+
+                static void work( ES::Synapps::Evaluator& evaluator, int const batch_size, bool const threshold, int const master = 0 );
+
+                /// Sub-master side.  Split the batches rank 0 sends among the
+                /// given ranks, batch_size trial points at a time, and return
+                /// the results of each batch together.  Terminates the ranks
+                /// when rank 0 terminates the sub-master.
+
+                static void relay( int const batch_size, const std::vector< int >& ranks );
+
+            private :
+
+                std::vector< int >              _ranks;         ///< Ranks of workers.
+                std::vector< int >              _batch_size;    ///< Maximum number of trial points per batch, by rank.
+                std::vector< int >              _free;          ///< Ranks of workers, once per batch they can take.
+                int                             _busy;          ///< Number of batches out with workers.
+                double                          _best;          ///< Smallest score received so far.
+
+                std::vector< double >           _batch;         ///< Next batch, as sent.
+                int                             _count;         ///< Number of trial points in the next batch.
+
+                std::deque< int >               _rank;          ///< Ranks that sent the received results.
+                std::deque< int >               _tag;           ///< Tags of the received results.
+                std::deque< APPSPACK::Vector >  _f;             ///< Received results.
+                std::deque< std::string >       _msg;           ///< Messages of the received results.
+
+                int                             _batches;       ///< Number of batches sent.
+                int                             _points;        ///< Number of trial points sent.
+
+                const APPSPACK::Constraints::Linear* _linear;   ///< Constraints on speculative trial points, null if none are made.
+
+                APPSPACK::Vector                _best_x;        ///< Trial point with the smallest score so far, the solver's best with simple decrease.
+                std::map< int, APPSPACK::Vector > _x;           ///< Trial points out, by tag.
+                std::deque< APPSPACK::Vector >  _steps;         ///< Recent steps from the best point to trial points.
+                std::vector< APPSPACK::Vector > _seen;          ///< Trial points around the best point, sent or guessed.
+                int                             _level;         ///< Number of times the steps were contracted for guesses.
+
+                std::deque< APPSPACK::Vector >  _guesses;       ///< Speculative trial points not yet sent.
+                std::map< int, int >            _wanted;        ///< Tags of trial points waiting on speculative ones, by speculative tag.
+                int                             _guess_tag;     ///< Tag of the last speculative trial point, counting down from -1.
+
+                std::vector< APPSPACK::Vector > _kept_x;        ///< Speculative trial points with results.
+                std::vector< APPSPACK::Vector > _kept_f;        ///< Results of speculative trial points.
+                std::vector< std::string >      _kept_msg;      ///< Messages of speculative trial points.
+                std::vector< int >              _kept_rank;     ///< Ranks that evaluated speculative trial points.
+
+                int                             _guessed;       ///< Number of speculative trial points sent.
+                int                             _hits;          ///< Number of trial points answered by speculative ones.
+
+                /// Send the next batch to a worker.
+
+                void _send();
+
+                /// Receive the results of one batch.
+
+                void _receive();
+
+                /// Queue a result for the solver.
+
+                void _deliver( int const rank, int const tag, const APPSPACK::Vector& f, const std::string& msg );
+
+                /// Answer a trial point with a speculative one, if they
+                /// match.  Returns true if it was.
+
+                bool _claim( const APPSPACK::Vector& x, int const tag );
+
+                /// Send speculative batches to idle workers.
+
+                void _fill();
+
+                /// Queue speculative trial points around the best point.
+
+                void _guess();
+
+                /// Receive a batch from the master rank, and size the buffer
+                /// for batches of up to capacity trial points.  Returns the
+                /// number of coordinates per trial point, 0 for a batch that
+                /// terminates the receiver.
+
+                static int _fetch( int const master, int const capacity, std::vector< double >& batch );
+
+        };
+
+    }
+
+}
+
+#endif
@@ -0,0 +1,98 @@
+// 
+// File    : ES_Synapps_LineShare.cc
+// ---------------------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so. 
+//
+
+#include "ES_Synapps_LineShare.hh"
+
+#include <iostream>
+
+ES::Synapps::LineShare::LineShare( std::vector< ES::Line >& lines, bool const node ) :
+    _base( 0 ),
+    _size( 0 ),
+    _win( MPI_WIN_NULL )
+{
+
+    int rank;
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+
+    _lines.swap( lines );
+
+#if MPI_VERSION >= 3
+    if( node )
+    {
+        MPI_Comm node_comm;
+        int      node_rank;
+        MPI_Comm_split_type( MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm );
+        MPI_Comm_rank( node_comm, &node_rank );
+
+        MPI_Comm leaders;
+        MPI_Comm_split( MPI_COMM_WORLD, node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leaders );
+        if( leaders != MPI_COMM_NULL )
+        {
+            broadcast( _lines, leaders );
+            MPI_Comm_free( &leaders );
+        }
+        long long line_size = _lines.size();
+        MPI_Bcast( &line_size, 1, MPI_LONG_LONG, 0, node_comm );
+
+        MPI_Aint bytes = node_rank == 0 ? MPI_Aint( line_size * sizeof( ES::Line ) ) : 0;
+        MPI_Win_allocate_shared( bytes, sizeof( ES::Line ), MPI_INFO_NULL, node_comm, &_base, &_win );
+        if( node_rank == 0 )
+        {
+            std::copy( _lines.begin(), _lines.end(), _base );
+            std::vector< ES::Line >().swap( _lines );
+        }
+        else
+        {
+            int disp;
+            MPI_Win_shared_query( _win, 0, &bytes, &disp, &_base );
+        }
+        MPI_Win_fence( 0, _win );
+        MPI_Comm_free( &node_comm );
+
+        _size = line_size;
+        if( _size == 0 ) _base = 0;
+        return;
+    }
+#else
+    if( node && rank == 0 )
+    {
+        std::cerr << "WARNING: opacity share_lines requires MPI-3, lines are not shared." << std::endl;
+    }
+#endif
+
+    broadcast( _lines, MPI_COMM_WORLD );
+    _base = _lines.empty() ? 0 : &_lines[ 0 ];
+    _size = _lines.size();
+
+}
+
+ES::Synapps::LineShare::~LineShare()
+{
+#if MPI_VERSION >= 3
+    if( _win != MPI_WIN_NULL ) MPI_Win_free( &_win );
+#endif
+}
@@ -0,0 +1,121 @@
+// 
+// File    : ES_Synapps_LineShare.hh
+// ---------------------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so. 
+//
+
+#ifndef ES__SYNAPPS__LINESHARE
+#define ES__SYNAPPS__LINESHARE
+
+#include "ES_Line.hh"
+
+#include <mpi.h>
+
+#include <vector>
+#include <algorithm>
+
+namespace ES
+{
+
+    namespace Synapps
+    {
+
+        /// Broadcast a vector of plain records from the first rank of a
+        /// communicator, in chunks small enough for MPI counts.
+
+        template< typename T >
+        void broadcast( std::vector< T >& data, MPI_Comm comm )
+        {
+            long long size = data.size();
+            MPI_Bcast( &size, 1, MPI_LONG_LONG, 0, comm );
+            data.resize( size );
+            if( size == 0 ) return;
+
+            char*     bytes = reinterpret_cast< char* >( &data[ 0 ] );
+            long long total = size * sizeof( T );
+            long long chunk = 1 << 30;
+            for( long long offset = 0; offset < total; offset += chunk )
+            {
+                MPI_Bcast( bytes + offset, int( std::min( chunk, total - offset ) ), MPI_BYTE, 0, comm );
+            }
+        }
+
+        /// @class LineShare
+        /// @brief Line list of rank 0, made available to every rank.
+        ///
+        /// Either every rank gets its own copy by broadcast, or ranks on a
+        /// node share one.  Then rank 0 broadcasts the lines to the lowest
+        /// rank on each node, which puts them into an MPI-3 shared memory
+        /// window that the other ranks there read.  Opacity operators take
+        /// the list through ES::Synow::Opacity::share, and must go before
+        /// the LineShare does.
+
+        class LineShare
+        {
+
+            public :
+
+                /// Constructor.  Collective over MPI_COMM_WORLD.  Takes the
+                /// lines, significant on rank 0 only, and leaves the vector
+                /// empty.  If node is true, share one copy per node.  That
+                /// needs MPI-3, else rank 0 warns and every rank gets a copy.
+
+                LineShare( std::vector< ES::Line >& lines, bool const node );
+
+                /// Destructor.  Collective if the lines are shared, and must
+                /// come before MPI is finalized.
+
+                ~LineShare();
+
+                /// Lines sorted by wavelength, null if there are none.
+
+                const ES::Line* lines() const { return _base; }
+
+                /// Number of lines.
+
+                size_t size() const { return _size; }
+
+                /// Returns true if ranks on a node share the lines.
+
+                bool shared() const { return _win != MPI_WIN_NULL; }
+
+            private :
+
+                std::vector< ES::Line > _lines;    ///< Lines of this rank, if not shared.
+                ES::Line*               _base;     ///< First line.
+                size_t                  _size;     ///< Number of lines.
+                MPI_Win                 _win;      ///< Shared memory window, or MPI_WIN_NULL.
+
+                /// Not copyable, because of the window.
+
+                LineShare( const LineShare& );
+                LineShare& operator = ( const LineShare& );
+
+        };
+
+    }
+
+}
+
+#endif
@@ -0,0 +1,113 @@
+// 
+// File    : ES_Synapps_ThreadExecutor.cc
+// --------------------------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so. 
+//
+
+
+#include "ES_Synapps_ThreadExecutor.hh"
+#include "ES_Synapps_Evaluator.hh"
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+#include <cmath>
+#include <iostream>
+
+ES::Synapps::ThreadExecutor::ThreadExecutor( const std::vector< ES::Synapps::Evaluator* >& evaluators ) :
+    _evaluators( evaluators ),
+    _done( 0 ),
+    _best( HUGE_VAL )
+{}
+
+bool ES::Synapps::ThreadExecutor::isWaiting() const
+{
+    return _f.empty() && _x.size() < _evaluators.size();
+}
+
+bool ES::Synapps::ThreadExecutor::spawn( const APPSPACK::Vector& x, int tag )
+{
+    if( ! isWaiting() ) return false;
+    _tag.push_back( tag );
+    _x.push_back( x );
+    return true;
+}
+
+int ES::Synapps::ThreadExecutor::recv( int& tag, APPSPACK::Vector& f, std::string& msg )
+{
+
+    // Evaluate the queued points, one per thread.  Operators inside an
+    // evaluation get one thread each, unless nested parallelism is on.
+
+    if( _f.empty() )
+    {
+        int size = _x.size();
+        if( size == 0 ) return 0;
+
+        _f.resize( size );
+        _msg.resize( size );
+        for( size_t t = 0; t < _evaluators.size(); ++ t ) _evaluators[ t ]->threshold( _best );
+
+        #pragma omp parallel for schedule( dynamic, 1 ) num_threads( size )
+        for( int i = 0; i < size; ++ i )
+        {
+            int t = 0;
+#ifdef _OPENMP
+            t = omp_get_thread_num();
+#endif
+            (*_evaluators[ t ])( _tag[ i ], _x[ i ], _f[ i ], _msg[ i ] );
+        }
+
+        _x.clear();
+        _done = 0;
+    }
+
+    // Hand the results back one at a time.
+
+    int i = _done ++;
+    tag = _tag[ i ];
+    f   = _f  [ i ];
+    msg = _msg[ i ];
+
+    // Scores stopped early exceed their threshold, so they never lower
+    // the best.
+
+    if( f.size() > 0 && f[ 0 ] < _best ) _best = f[ 0 ];
+
+    if( _done == int( _f.size() ) )
+    {
+        _tag.clear();
+        _f.clear();
+        _msg.clear();
+    }
+
+    return i + 1;
+
+}
+
+void ES::Synapps::ThreadExecutor::print() const
+{
+    std::cout << "ES::Synapps::ThreadExecutor with " << _evaluators.size() << " threads, best score " << _best << std::endl;
+}
@@ -0,0 +1,104 @@
+// 
+// File    : ES_Synapps_ThreadExecutor.hh
+// --------------------------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so. 
+//
+
+
+#ifndef ES__SYNAPPS__THREADEXECUTOR
+#define ES__SYNAPPS__THREADEXECUTOR
+
+#include <appspack/APPSPACK_Executor_Interface.hpp>
+#include <appspack/APPSPACK_Vector.hpp>
+
+#include <vector>
+#include <string>
+
+namespace ES
+{
+
+    namespace Synapps
+    {
+
+        class Evaluator;
+
+        /// @class ThreadExecutor
+        /// @brief Executor that evaluates trial points on threads.
+        ///
+        /// Lets a single process run synapps without an MPI master and
+        /// workers.  Each thread has its own Evaluator, with its own Grid
+        /// and operators behind it.  Trial points are queued until there
+        /// is one per thread or the solver asks for results, then they
+        /// are all evaluated at once.  Each evaluation gets the smallest
+        /// score received so far as its early abort threshold, the same
+        /// rule as ES::Synapps::Executor.  That is the solver's best score
+        /// when it runs with simple decrease, see ES::Synapps::Config.
+
+        class ThreadExecutor : public APPSPACK::Executor::Interface
+        {
+
+            public :
+
+                /// Constructor, taking one Evaluator per thread.
+
+                ThreadExecutor( const std::vector< ES::Synapps::Evaluator* >& evaluators );
+
+                /// Returns true if fewer points are queued than there are
+                /// threads.
+
+                virtual bool isWaiting() const;
+
+                /// Queue a trial point.
+
+                virtual bool spawn( const APPSPACK::Vector& x, int tag );
+
+                /// Return a result and a nonzero id, evaluating the queued
+                /// points first if there are no results left.  Returns 0
+                /// if nothing is queued.
+
+                virtual int recv( int& tag, APPSPACK::Vector& f, std::string& msg );
+
+                /// Prints information about the executor object.
+
+                virtual void print() const;
+
+            private :
+
+                std::vector< ES::Synapps::Evaluator* > _evaluators;     ///< One Evaluator per thread.
+
+                std::vector< int              > _tag;   ///< Tags of queued points, then of results.
+                std::vector< APPSPACK::Vector > _x;     ///< Queued trial points.
+                std::vector< APPSPACK::Vector > _f;     ///< Results not yet returned.
+                std::vector< std::string      > _msg;   ///< Messages of results not yet returned.
+                int                             _done;  ///< Number of results returned.
+
+                double _best;                           ///< Smallest score received so far.
+
+        };
+
+    }
+
+}
+
+#endif
@@ -0,0 +1,198 @@
+//
+// File    : check_abort.cc
+// ------------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so. 
+//
+
+// Checks that a solver never accepts the score of an evaluation stopped
+// early.  With early abort, ES::Synapps::Config must have the solver
+// accept any decrease, so that its best score is the threshold.  Then a
+// stopped evaluation must report a score above the threshold, however
+// close the threshold is to the true score, also when the single process
+// executor sets the thresholds.
+
+#include "ES_Synapps_Config.hh"
+#include "ES_Synapps_Evaluator.hh"
+#include "ES_Synapps_ThreadExecutor.hh"
+#include "check.hh"
+
+#include <appspack/APPSPACK_Vector.hpp>
+#include <appspack/APPSPACK_Parameter_List.hpp>
+
+#include <yaml-cpp/yaml.h>
+
+#include <sstream>
+#include <string>
+
+// Search configuration of one ion.
+
+const char* config_text =
+    "fit_file   : check_abort.fit\n"
+    "cache_file : check_abort.cache\n"
+    "a0         : { fixed:  No, start:  1, lower:   0, upper: 10, scale: 10 }\n"
+    "a1         : { fixed:  No, start:  0, lower: -10, upper: 10, scale: 20 }\n"
+    "a2         : { fixed:  No, start:  0, lower: -10, upper: 10, scale: 20 }\n"
+    "v_phot     : { fixed:  No, start: 10, lower:   5, upper: 15, scale: 10 }\n"
+    "v_outer    : { fixed: Yes, start: 30, lower:  15, upper: 30, scale:  1 }\n"
+    "t_phot     : { fixed:  No, start: 12, lower:   5, upper: 25, scale: 20 }\n"
+    "ions       : [ 1401 ]\n"
+    "active     : [  Yes ]\n"
+    "detach     : [   No ]\n"
+    "log_tau    : { fixed: [  No ], start: [  1 ], lower: [ -2 ], upper: [  2 ], scale: [ 1 ] }\n"
+    "v_min      : { fixed: [  No ], start: [ 10 ], lower: [  5 ], upper: [ 15 ], scale: [ 1 ] }\n"
+    "v_max      : { fixed: [ Yes ], start: [ 30 ], lower: [ 15 ], upper: [ 30 ], scale: [ 1 ] }\n"
+    "aux        : { fixed: [  No ], start: [  5 ], lower: [  1 ], upper: [ 10 ], scale: [ 1 ] }\n"
+    "temp       : { fixed: [  No ], start: [ 10 ], lower: [  5 ], upper: [ 25 ], scale: [ 1 ] }\n";
+
+// Search vector of a setup.
+
+APPSPACK::Vector point( const ES::Synow::Setup& setup )
+{
+    APPSPACK::Vector x;
+    x.push_back( setup.a0 );
+    x.push_back( setup.a1 );
+    x.push_back( setup.a2 );
+    x.push_back( setup.v_phot );
+    x.push_back( setup.v_outer );
+    x.push_back( setup.t_phot );
+    const std::vector< double >* values[] = { &setup.log_tau, &setup.v_min, &setup.v_max, &setup.aux, &setup.temp };
+    for( int k = 0; k < 5; ++ k )
+    {
+        for( size_t i = 0; i < values[ k ]->size(); ++ i ) x.push_back( ( *values[ k ] )[ i ] );
+    }
+    return x;
+}
+
+int main()
+{
+
+    int failed = 0;
+
+    // Sufficient decrease, off with early abort and left to the solver
+    // otherwise.
+
+    {
+        std::istringstream stream( config_text );
+        YAML::Parser       parser( stream );
+        YAML::Node         yaml;
+        parser.GetNextDocument( yaml );
+
+        ES::Synapps::Config simple( yaml, false, false, true );
+        ES::Synapps::Config plain ( yaml, false, false, false );
+        failed += ES::Check::report( "solver decrease factor with early abort",
+                simple.params.sublist( "Solver" ).getDoubleParameter( "Sufficient Decrease Factor" ), 0.0 );
+        failed += ES::Check::report( "solver decrease factor set without early abort",
+                plain.params.sublist( "Solver" ).isParameter( "Sufficient Decrease Factor" ) ? 1.0 : 0.0, 0.0 );
+    }
+
+    // Target spectrum from one setup, fit at others.  One stack scores
+    // them in full, the other stops early.
+
+    std::vector< int >      ions = ES::Check::ions();
+    std::vector< ES::Line > lines;
+    ES::Check::lines( ions, 2500.0, 8000.0, 400, lines );
+    std::vector< ES::Line > refs = ES::Check::refs( ions );
+    ES::Check::Stack full_stack ( lines, refs );
+    ES::Check::Stack abort_stack( lines, refs );
+
+    ES::Synow::Setup setup = ES::Check::setup( ions );
+    full_stack.grid( setup );
+
+    ES::Spectrum target = ES::Spectrum::create_from_spectrum( full_stack.output );
+    for( size_t i = 0; i < target.size(); ++ i )
+    {
+        target.flux( i )       = full_stack.output.flux( i );
+        target.flux_error( i ) = 0.02 * fabs( full_stack.output.flux( i ) ) + 1.0e-6;
+    }
+
+    std::vector< double > none;
+    ES::Synapps::Evaluator full ( full_stack.grid,  target, full_stack.output,  ions, none, none, none, 2.0 );
+    ES::Synapps::Evaluator abort( abort_stack.grid, target, abort_stack.output, ions, none, none, none, 2.0 );
+    abort.early_abort( abort_stack.spectrum );
+
+    // A solver with simple decrease whose best is the threshold accepts
+    // only lower scores, and only a true score may be one.  The setup
+    // changes every time, as an unchanged one is not recomputed.
+
+    double factors[] = { 0.1, 0.5, 0.9, 0.99, 0.999, 0.999999, 1.0 - 1.0e-15, 1.0, 1.5 };
+    int    accepted  = 0;
+    for( int k = 0; k < 9; ++ k )
+    {
+        for( size_t i = 0; i < ions.size(); ++ i )
+        {
+            setup.log_tau[ i ] += 0.02;
+            setup.temp   [ i ] += 0.2;
+        }
+        APPSPACK::Vector x = point( setup );
+
+        APPSPACK::Vector f;
+        std::string      msg;
+        full( k, x, f, msg );
+        double score     = f[ 0 ];
+        double threshold = factors[ k ] * score;
+
+        abort.threshold( threshold );
+        abort( k, x, f, msg );
+        if( f[ 0 ] < threshold && f[ 0 ] != score ) ++ accepted;
+    }
+
+    abort.report( std::cout );
+    failed += ES::Check::report( "stopped evaluations accepted", accepted, 0.0 );
+
+    // The single process executor, fed a walk that improves now and then,
+    // thresholds each evaluation at the smallest score it has returned.
+    // That is the best of a solver with simple decrease, which must never
+    // accept a score other than the true one.
+
+    std::vector< ES::Synapps::Evaluator* > evaluators( 1, &abort );
+    ES::Synapps::ThreadExecutor executor( evaluators );
+
+    double best = HUGE_VAL;
+    accepted    = 0;
+    for( int k = 0; k < 12; ++ k )
+    {
+        for( size_t i = 0; i < ions.size(); ++ i ) setup.log_tau[ i ] += k % 3 == 0 ? -0.15 : 0.05;
+        APPSPACK::Vector x = point( setup );
+
+        int              tag;
+        APPSPACK::Vector f;
+        std::string      msg;
+        full( k, x, f, msg );
+        double score = f[ 0 ];
+
+        executor.spawn( x, k );
+        executor.recv( tag, f, msg );
+        if( f[ 0 ] < best )
+        {
+            if( f[ 0 ] != score ) ++ accepted;
+            best = f[ 0 ];
+        }
+    }
+
+    abort.report( std::cout );
+    failed += ES::Check::report( "stopped evaluations accepted by the thread executor", accepted, 0.0 );
+
+    return failed;
+
+}
@@ -0,0 +1,119 @@
+//
+// File    : check_share.cc
+// ------------------------
+//
+// ES: Elementary Supernova Spectrum Synthesis, Copyright (c) 2010, The
+// Regents of the University of California, through Lawrence Berkeley
+// National Laboratory (subject to receipt of any required approvals
+// from the U.S. Dept. of Energy). All rights reserved.
+//
+// If you have questions about your rights to use or distribute this
+// software, please contact Berkeley Lab's Technology Transfer
+// Department at TTD@lbl.gov.
+//
+// NOTICE. This software was developed under partial funding from the
+// U.S. Department of Energy. As such, the U.S. Government has been
+// granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, and perform publicly and display
+// publicly. Beginning five (5) years after the date permission to
+// assert copyright is obtained from the U.S. Department of Energy, and
+// subject to any subsequent five (5) year renewals, the U.S. Government
+// is granted for itself and others acting on its behalf a paid-up,
+// nonexclusive, irrevocable, worldwide license in the Software to
+// reproduce, prepare derivative works, distribute copies to the public,
+// perform publicly and display publicly, and to permit others to do so. 
+//
+
+// Checks that lines of rank 0 shared through ES::Synapps::LineShare give
+// every rank spectra bit for bit the same as lines it made up itself,
+// by broadcast and through shared memory.  Each rank activates its own
+// ion subsets, and lists one ion twice.  Run it on 3 ranks or more.
+
+#include "ES_Synapps_LineShare.hh"
+#include "check.hh"
+
+#include <mpi.h>
+
+#include <sstream>
+
+// A setup activating a subset of the ions that depends on the rank and
+// step, with one ion listed again at another temperature.
+
+ES::Synow::Setup subset( const std::vector< int >& ions, int const rank, int const k )
+{
+    ES::Synow::Setup setup = ES::Check::setup( ions );
+    for( size_t i = 0; i < ions.size(); ++ i ) setup.active[ i ] = ( i + rank + k ) % 3 != 0;
+
+    size_t i = ions.size();
+    size_t j = ( rank + k ) % ions.size();
+    setup.resize( i + 1 );
+    setup.ions   [ i ] = ions[ j ];
+    setup.active [ i ] = true;
+    setup.log_tau[ i ] = setup.log_tau[ j ] - 0.2;
+    setup.v_min  [ i ] = setup.v_min  [ j ];
+    setup.v_max  [ i ] = setup.v_max  [ j ];
+    setup.aux    [ i ] = setup.aux    [ j ];
+    setup.temp   [ i ] = setup.temp   [ j ] + 3.0;
+    return setup;
+}
+
+int main( int argc, char* argv[] )
+{
+
+    MPI_Init( &argc, &argv );
+
+    int rank, rank_size;
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &rank_size );
+
+    // Every rank makes up the lines and reference lines for its own
+    // spectra.  The shared ones come from rank 0.
+
+    std::vector< int >      ions = ES::Check::ions();
+    std::vector< ES::Line > local;
+    ES::Check::lines( ions, 2500.0, 8000.0, 400, local );
+    ES::Check::Stack own( local, ES::Check::refs( ions ) );
+
+    std::vector< ES::Line > refs;
+    if( rank == 0 ) refs = ES::Check::refs( ions );
+    ES::Synapps::broadcast( refs, MPI_COMM_WORLD );
+
+    int failed = 0;
+    for( int node = 0; node < 2; ++ node )
+    {
+        std::vector< ES::Line > lines;
+        if( rank == 0 ) lines = local;
+
+        ES::Synapps::LineShare* line_share = new ES::Synapps::LineShare( lines, node == 1 );
+        ES::Check::Stack*       shared     = new ES::Check::Stack( std::vector< ES::Line >(), refs );
+        shared->opacity.share( line_share->lines(), line_share->size() );
+
+        double largest = 0.0;
+        for( int k = 0; k < 6; ++ k )
+        {
+            ES::Synow::Setup setup = subset( ions, rank, k );
+            own.grid( setup );
+            shared->grid( setup );
+            largest = std::max( largest, ES::Check::difference( own.output, shared->output ) );
+        }
+
+        double all_largest;
+        MPI_Reduce( &largest, &all_largest, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD );
+        if( rank == 0 )
+        {
+            std::stringstream name;
+            name << "local and " << ( line_share->shared() ? "node shared" : "broadcast" ) << " lines on " << rank_size << " ranks";
+            failed += ES::Check::report( name.str().c_str(), all_largest, 0.0 );
+        }
+
+        delete shared;
+        delete line_share;
+    }
+
+    MPI_Bcast( &failed, 1, MPI_INT, 0, MPI_COMM_WORLD );
+    MPI_Finalize();
+
+    return failed;
+
+}
@@ -0,0 +1,6 @@
+#!/bin/sh
+#
+# Runs check_share on three ranks.  Set MPIEXEC to the MPI launcher and
+# any options it needs, for instance "mpirun --oversubscribe".
+
+${MPIEXEC:-mpiexec} -n 3 ./check_share
@@ -34,7 +34,18 @@
 
 #include <yaml-cpp/yaml.h>
 
+#include <mpi.h>
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <iterator>
+#include <algorithm>
 #include <csignal>
 #include <csetjmp>
 
@@ -45,71 +56,122 @@ void signal_handler( int param )
     longjmp( env, 1 );
 }
 
+// Optional Yes/No setting, No if it is absent.
+
+bool optional( const YAML::Node& node, const char* key )
+{
+    bool value = false;
+    if( const YAML::Node* found = node.FindValue( key ) ) *found >> value;
+    return value;
+}
+
+// A Grid with its operators and an evaluator.  Each MPI worker needs
+// one, and a single process needs one per thread.
+
+struct Stack
+{
+
+    Stack( const YAML::Node& yaml, ES::Spectrum& target, const std::vector< int >& ions,
+            const std::vector< double >& region_weight, const std::vector< double >& region_lower,
+            const std::vector< double >& region_upper ) :
+        output   ( ES::Spectrum::create_from_spectrum( target ) ),
+        reference( ES::Spectrum::create_from_spectrum( target ) ),
+        grid     ( ES::Synow::Grid::create( 
+                    target.min_wl(),
+                    target.max_wl(),
+                    yaml[ "grid"   ][ "bin_width"   ], 
+                    yaml[ "grid"   ][ "v_size"      ],
+                    yaml[ "grid"   ][ "v_outer_max" ] ) ),
+        opacity  ( grid,
+                    yaml[ "opacity" ][ "line_dir"    ],
+                    yaml[ "opacity" ][ "ref_file"    ],
+                    yaml[ "opacity" ][ "form"        ],
+                    yaml[ "opacity" ][ "v_ref"       ],
+                    yaml[ "opacity" ][ "log_tau_min" ] ),
+        source   ( grid,
+                    yaml[ "source" ][ "mu_size" ],
+                    optional( yaml[ "source" ], "reference" ) ),
+        spectrum ( grid, output, reference,
+                    yaml[ "spectrum" ][ "p_size"  ],
+                    yaml[ "spectrum" ][ "flatten" ] ),
+        evaluator( grid, target, output, ions, region_weight, region_lower, region_upper,
+                    yaml[ "evaluator" ][ "vector_norm" ] )
+    {}
+
+    ES::Spectrum           output;      ///< Synthetic spectrum.
+    ES::Spectrum           reference;   ///< Reference pseudo-continuum for flattening.
+    ES::Synow::Grid        grid;        ///< Grid the operators are attached to.
+    ES::Synow::Opacity     opacity;     ///< Opacity operator.
+    ES::Synow::Source      source;      ///< Source operator.
+    ES::Synow::Spectrum    spectrum;    ///< Spectrum operator.
+    ES::Synapps::Evaluator evaluator;   ///< Objective function.
+
+};
+
 int main( int argc, char* argv[] )
 {
 
-    // Initialize MPI, 2 or more processors.
+    // Initialize MPI.  With 2 or more processors rank 0 is the master
+    // and the rest are workers.  A single process evaluates on threads.
 
     int rank = APPSPACK::GCI::init( argc, argv );
     int workers = APPSPACK::GCI::getNumProcs() - 1;
-    if( workers < 1 )
-    {
-        std::cerr << "ERROR: Program requires at least 2 processors." << std::endl;
-        APPSPACK::GCI::exit();
-        return 137;
-    }
+
+    // Only rank 0 reads files.  Everything else gets what it needs by
+    // broadcast, so startup file system load does not grow with the
+    // number of ranks.
 
     // Configuration in this application comes from a YAML file.
 
     YAML::Node yaml;
 
     {
-        std::ifstream  stream( argv[ 1 ] );
-        YAML::Parser   parser( stream );
+        std::vector< char > text;
+        if( rank == 0 )
+        {
+            std::ifstream stream( argv[ 1 ] );
+            text.assign( std::istreambuf_iterator< char >( stream ), std::istreambuf_iterator< char >() );
+            stream.close();
+        }
+        ES::Synapps::broadcast( text, MPI_COMM_WORLD );
+
+        std::istringstream stream( std::string( text.begin(), text.end() ) );
+        YAML::Parser       parser( stream );
         parser.GetNextDocument( yaml );
-        stream.close();
     }
 
     // Target and output spectra.  The output spectrum is sampled 
     // at the same wavelengths as the target spectrum.
 
-    std::string target_file = yaml[ "evaluator" ][ "target_file" ];
-    ES::Spectrum target    = ES::Spectrum::create_from_ascii_file( target_file.c_str() );
-    ES::Spectrum output    = ES::Spectrum::create_from_spectrum( target );
-    ES::Spectrum reference = ES::Spectrum::create_from_spectrum( target );
+    ES::Spectrum target;
 
-//  target.rescale_median_flux();
-
-    // Grid object.
-
-    ES::Synow::Grid grid = ES::Synow::Grid::create( 
-            target.min_wl(),
-            target.max_wl(),
-            yaml[ "grid"   ][ "bin_width"   ], 
-            yaml[ "grid"   ][ "v_size"      ],
-            yaml[ "grid"   ][ "v_outer_max" ] );
-
-    // Opacity operator.
-
-    ES::Synow::Opacity opacity( grid,
-            yaml[ "opacity" ][ "line_dir"    ],
-            yaml[ "opacity" ][ "ref_file"    ],
-            yaml[ "opacity" ][ "form"        ],
-            yaml[ "opacity" ][ "v_ref"       ],
-            yaml[ "opacity" ][ "log_tau_min" ] );
-
-    // Source operator.
-
-    ES::Synow::Source source( grid,
-            yaml[ "source" ][ "mu_size" ] );
+    {
+        std::vector< double > columns;
+        if( rank == 0 )
+        {
+            std::string target_file = yaml[ "evaluator" ][ "target_file" ];
+            target = ES::Spectrum::create_from_ascii_file( target_file.c_str() );
+            for( size_t i = 0; i < target.size(); ++ i )
+            {
+                columns.push_back( target.wl( i ) );
+                columns.push_back( target.flux( i ) );
+                columns.push_back( target.flux_error( i ) );
+            }
+        }
+        ES::Synapps::broadcast( columns, MPI_COMM_WORLD );
 
-    // Spectrum operator.
+        target = ES::Spectrum::create_from_size( columns.size() / 3 );
+        for( size_t i = 0; i < target.size(); ++ i )
+        {
+            target.wl( i )         = columns[ 3 * i     ];
+            target.flux( i )       = columns[ 3 * i + 1 ];
+            target.flux_error( i ) = columns[ 3 * i + 2 ];
+        }
+    }
 
-    ES::Synow::Spectrum spectrum( grid, output, reference,
-            yaml[ "spectrum" ][ "p_size"  ],
-            yaml[ "spectrum" ][ "flatten" ] );
+//  target.rescale_median_flux();
 
-    // Evaluator.
+    // Active ions, and the distinct ones among them.
 
     std::vector< int > ions;
     for( size_t i = 0; i < yaml[ "config" ][ "active" ].size(); ++ i )
@@ -118,6 +180,12 @@ int main( int argc, char* argv[] )
         ions.push_back( yaml[ "config" ][ "ions" ][ i ] );
     }
 
+    std::vector< int > distinct_ions( ions );
+    std::sort( distinct_ions.begin(), distinct_ions.end() );
+    distinct_ions.erase( std::unique( distinct_ions.begin(), distinct_ions.end() ), distinct_ions.end() );
+
+    // Fit regions.
+
     std::vector< double > region_weight;
     std::vector< double > region_lower;
     std::vector< double > region_upper;
@@ -129,24 +197,272 @@ int main( int argc, char* argv[] )
         region_upper.push_back ( yaml[ "evaluator" ][ "regions" ][ "upper"  ][ i ] );
     }
 
-    ES::Synapps::Evaluator evaluator( grid, target, output, ions, region_weight, region_lower, region_upper,
-            yaml[ "evaluator" ][ "vector_norm" ] );
+    // Grids, operators and evaluators, one stack per thread in a single
+    // process.  They all share one line list.
 
-    // Master section.
+    int stack_size = 1;
+#ifdef _OPENMP
+    if( workers < 1 ) stack_size = omp_get_max_threads();
+#endif
+
+    std::vector< Stack* > stacks;
+    for( int t = 0; t < stack_size; ++ t ) stacks.push_back( new Stack( yaml, target, ions, region_weight, region_lower, region_upper ) );
+
+    ES::Synow::Opacity&     opacity   = stacks[ 0 ]->opacity;
+    ES::Synapps::Evaluator& evaluator = stacks[ 0 ]->evaluator;
+    ES::Spectrum&           output    = stacks[ 0 ]->output;
+
+    // Optionally tabulate line strengths against temperature, over the
+    // range the fit can explore.
+
+    if( const YAML::Node* temp_size = yaml[ "opacity" ].FindValue( "temp_size" ) )
+    {
+        const YAML::Node& temp = yaml[ "config" ][ "temp" ];
+        double temp_min = 0.0;
+        double temp_max = 0.0;
+        for( size_t i = 0; i < yaml[ "config" ][ "active" ].size(); ++ i )
+        {
+            if( ! yaml[ "config" ][ "active" ][ i ] ) continue;
+            double start = temp[ "start" ][ i ];
+            double lower = temp[ "lower" ][ i ];
+            double upper = temp[ "upper" ][ i ];
+            lower = std::min( lower, start );
+            upper = std::max( upper, start );
+            if( temp_max == 0.0 || lower < temp_min ) temp_min = lower;
+            if( temp_max == 0.0 || upper > temp_max ) temp_max = upper;
+        }
+        for( int t = 0; t < stack_size; ++ t ) stacks[ t ]->opacity.tabulate( temp_min, temp_max, *temp_size );
+    }
+
+    // Reference lines of the active ions.
+
+    {
+        std::vector< ES::Line > ref_lines;
+        if( rank == 0 ) opacity.read_refs( distinct_ions, ref_lines );
+        ES::Synapps::broadcast( ref_lines, MPI_COMM_WORLD );
+        for( int t = 0; t < stack_size; ++ t ) stacks[ t ]->opacity.share_refs( ref_lines );
+    }
+
+    // Lines of the active ions.  Optionally, ranks on a node share one
+    // copy of the line list.
+
+    std::vector< ES::Line > lines;
+    if( rank == 0 ) opacity.load( distinct_ions, lines );
+
+    bool share_lines = false;
+    if( const YAML::Node* share = yaml[ "opacity" ].FindValue( "share_lines" ) ) *share >> share_lines;
+
+    ES::Synapps::LineShare* line_share = new ES::Synapps::LineShare( lines, share_lines );
+    for( int t = 0; t < stack_size; ++ t ) stacks[ t ]->opacity.share( line_share->lines(), line_share->size() );
+
+    // Optionally cull lines that cannot reach the opacity threshold for
+    // any parameters inside the configured bounds.
+
+    bool cull_lines = false;
+    if( const YAML::Node* cull = yaml[ "opacity" ].FindValue( "cull_lines" ) ) *cull >> cull_lines;
+    if( cull_lines )
+    {
+        const YAML::Node& config = yaml[ "config" ];
+        ES::Synow::Setup  lower;
+        ES::Synow::Setup  upper;
+        lower.resize( ions.size() );
+        upper.resize( ions.size() );
+
+        double v_phot_start = config[ "v_phot" ][ "start" ];
+        double v_phot_lower = config[ "v_phot" ][ "lower" ];
+        lower.v_phot = std::min( v_phot_lower, v_phot_start );
+
+        const char* names[] = { "log_tau", "v_min", "aux", "temp" };
+        std::vector< double >* lower_values[] = { &lower.log_tau, &lower.v_min, &lower.aux, &lower.temp };
+        std::vector< double >* upper_values[] = { &upper.log_tau, &upper.v_min, &upper.aux, &upper.temp };
+
+        int j = 0;
+        for( size_t i = 0; i < config[ "active" ].size(); ++ i )
+        {
+            if( ! config[ "active" ][ i ] ) continue;
+            lower.ions  [ j ] = upper.ions  [ j ] = ions[ j ];
+            lower.active[ j ] = upper.active[ j ] = true;
+            for( int k = 0; k < 4; ++ k )
+            {
+                double start = config[ names[ k ] ][ "start" ][ i ];
+                double low   = config[ names[ k ] ][ "lower" ][ i ];
+                double high  = config[ names[ k ] ][ "upper" ][ i ];
+                ( *lower_values[ k ] )[ j ] = std::min( low,  start );
+                ( *upper_values[ k ] )[ j ] = std::max( high, start );
+            }
+            ++ j;
+        }
+
+        for( int t = 0; t < stack_size; ++ t ) stacks[ t ]->opacity.cull( lower, upper );
+        if( rank == 0 ) opacity.report( std::cerr );
+    }
+
+    // Optionally recompute opacity only for the ions a trial point
+    // changes.
+
+    const YAML::Node* incremental = yaml[ "opacity" ].FindValue( "incremental" );
+    for( int t = 0; incremental && t < stack_size; ++ t ) stacks[ t ]->opacity.incremental( *incremental );
+
+    // Optionally solve for the warp coefficients in each evaluation, and
+    // leave them out of the search.
+
+    bool fit_warp = false;
+    if( const YAML::Node* fit = yaml[ "evaluator" ].FindValue( "fit_warp" ) ) *fit >> fit_warp;
+
+    bool flatten = yaml[ "spectrum" ][ "flatten" ];
+    if( fit_warp && flatten )
+    {
+        if( rank == 0 ) std::cerr << "WARNING: evaluator fit_warp has no effect on a flattened spectrum, it is disabled." << std::endl;
+        fit_warp = false;
+    }
+
+    if( fit_warp )
+    {
+        const char* names[] = { "a0", "a1", "a2" };
+        std::vector< double > start( 3 );
+        std::vector< bool   > fixed( 3 );
+        for( int k = 0; k < 3; ++ k )
+        {
+            bool fix;
+            yaml[ "config" ][ names[ k ] ][ "start" ] >> start[ k ];
+            yaml[ "config" ][ names[ k ] ][ "fixed" ] >> fix;
+            fixed[ k ] = fix;
+        }
+        for( int t = 0; t < stack_size; ++ t ) stacks[ t ]->evaluator.fit_warp( start, fixed );
+
+        double vector_norm = yaml[ "evaluator" ][ "vector_norm" ];
+        if( vector_norm != 2.0 && rank == 0 )
+        {
+            std::cerr << "WARNING: evaluator fit_warp minimizes the vector_norm 2 objective, not this one." << std::endl;
+        }
+    }
+
+    // Optionally stop evaluations as soon as they cannot beat the best
+    // score so far, which the master sends along with each trial point.
+
+    bool early_abort = false;
+    if( const YAML::Node* abort = yaml[ "evaluator" ].FindValue( "early_abort" ) ) *abort >> early_abort;
+    if( early_abort && fit_warp )
+    {
+        if( rank == 0 ) std::cerr << "WARNING: evaluator early_abort does not apply with fit_warp, it is disabled." << std::endl;
+        early_abort = false;
+    }
+    for( int t = 0; early_abort && t < stack_size; ++ t ) stacks[ t ]->evaluator.early_abort( stacks[ t ]->spectrum );
+
+    // Optionally evaluate speculative trial points on workers the solver
+    // leaves idle.
+
+    bool speculate = false;
+    if( const YAML::Node* guess = yaml[ "evaluator" ].FindValue( "speculate" ) ) *guess >> speculate;
+
+    // Search configuration.  Optionally leave fixed parameters out of the
+    // search vector and search tied ones as one, instead of constraining
+    // them.  Early abort thresholds and speculative guesses start from the
+    // lowest score received, which is the solver's best only if it accepts
+    // any decrease.
+
+    bool reduce = false;
+    if( const YAML::Node* free = yaml[ "evaluator" ].FindValue( "reduce" ) ) *free >> reduce;
+
+    ES::Synapps::Config config( yaml[ "config" ], fit_warp, reduce, early_abort || speculate );
+    for( int t = 0; reduce && t < stack_size; ++ t ) stacks[ t ]->evaluator.reduce( config.index, config.value );
+
+    // Optionally send workers several trial points per message.
+
+    int batch_size = 1;
+    if( const YAML::Node* batch = yaml[ "evaluator" ].FindValue( "batch_size" ) ) *batch >> batch_size;
+
+    // Optionally relay batches through one sub-master per node, so rank 0
+    // only talks to nodes.  On each node the lowest rank other than rank 0
+    // is the sub-master, and the other ranks there are its workers.  A
+    // rank alone on its node works for rank 0 directly.
+
+    bool tree = false;
+    if( const YAML::Node* relay = yaml[ "evaluator" ].FindValue( "tree" ) ) *relay >> tree;
+
+    bool batched = early_abort || batch_size > 1 || tree || speculate;
+
+    int                parent = 0;      // Rank this rank gets batches from.
+    std::vector< int > children;        // Ranks this rank sends batches to.
+    std::vector< int > batch_sizes;     // Trial points per batch for each of them.
 
     if( rank == 0 )
     {
+        for( int i = 1; i <= workers; ++ i ) children.push_back( i );
+        batch_sizes.assign( workers, batch_size );
+    }
 
-        ES::Synapps::Config config( yaml[ "config" ] );
+#if MPI_VERSION >= 3
+    if( tree && workers > 0 )
+    {
+        MPI_Comm node;
+        int      node_size;
+        MPI_Comm_split_type( MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node );
+        MPI_Comm_size( node, &node_size );
+
+        std::vector< int > node_ranks( node_size );
+        MPI_Allgather( &rank, 1, MPI_INT, &node_ranks[ 0 ], 1, MPI_INT, node );
+        MPI_Comm_free( &node );
+        node_ranks.erase( std::remove( node_ranks.begin(), node_ranks.end(), 0 ), node_ranks.end() );
+
+        if( rank != 0 && node_ranks.size() > 1 )
+        {
+            if( rank == node_ranks[ 0 ] )
+            {
+                children.assign( node_ranks.begin() + 1, node_ranks.end() );
+            }
+            else
+            {
+                parent = node_ranks[ 0 ];
+            }
+        }
+
+        // Rank 0 sends each sub-master batches for all its workers.
+
+        int load = rank != 0 && parent == 0 ? std::max( int( children.size() ), 1 ) : 0;
+        std::vector< int > loads( workers + 1 );
+        MPI_Gather( &load, 1, MPI_INT, &loads[ 0 ], 1, MPI_INT, 0, MPI_COMM_WORLD );
+
+        if( rank == 0 )
+        {
+            children.clear();
+            batch_sizes.clear();
+            for( int i = 1; i <= workers; ++ i )
+            {
+                if( loads[ i ] == 0 ) continue;
+                children.push_back( i );
+                batch_sizes.push_back( loads[ i ] * batch_size );
+            }
+        }
+    }
+#else
+    if( tree && rank == 0 )
+    {
+        std::cerr << "WARNING: evaluator tree requires MPI-3, rank 0 serves every worker." << std::endl;
+    }
+#endif
+
+    // Master section.
+
+    if( rank == 0 )
+    {
 
         // Executor, constraints, solver.
 
-        APPSPACK::Executor::MPI       executor;
+        std::vector< ES::Synapps::Evaluator* > evaluators;
+        for( int t = 0; t < stack_size; ++ t ) evaluators.push_back( &stacks[ t ]->evaluator );
+
+        APPSPACK::Executor::MPI        mpi_executor;
+        ES::Synapps::Executor          batch_executor( children, batch_sizes );
+        ES::Synapps::ThreadExecutor    thread_executor( evaluators );
+        APPSPACK::Executor::Interface* executor = &mpi_executor;
+        if( batched     ) executor = &batch_executor;
+        if( workers < 1 ) executor = &thread_executor;
+
         APPSPACK::Constraints::Linear linear( config.params.sublist( "Linear" ) );
-        APPSPACK::Solver              solver( config.params.sublist( "Solver" ), executor, linear );
-//      APPSPACK::Solver::State       state = solver.solve();
-        APPSPACK::Solver::State       state;
-      
+        if( speculate ) batch_executor.speculate( linear );
+        APPSPACK::Solver              solver( config.params.sublist( "Solver" ), *executor, linear );
+
         // Signal handler, wrapping solver.
 
         signal( SIGTERM, signal_handler );
@@ -154,7 +470,7 @@ int main( int argc, char* argv[] )
         int terminated = setjmp( env );
         if( ! terminated )
         {
-            state = solver.solve();
+            solver.solve();
         }
         else
         {
@@ -168,13 +484,21 @@ int main( int argc, char* argv[] )
 
         // Problem solved, terminate workers.
 
-        APPSPACK::GCI::initSend();
-        APPSPACK::GCI::pack( 1 );
-        for( int i = 0; i < workers; ++ i ) APPSPACK::GCI::send( APPSPACK::Executor::MPI::Terminate, i + 1 );
+        if( batched )
+        {
+            batch_executor.terminate();
+        }
+        else
+        {
+            APPSPACK::GCI::initSend();
+            APPSPACK::GCI::pack( 1 );
+            for( int i = 0; i < workers; ++ i ) APPSPACK::GCI::send( APPSPACK::Executor::MPI::Terminate, i + 1 );
+        }
 
-        // Best spectrum.
+        // Best spectrum.  Evaluated in full, whatever threshold the
+        // threads were last given.
 
-        int tag;
+        int tag = 0;
         APPSPACK::Vector x;
         APPSPACK::Vector f;
         std::string msg;
@@ -182,18 +506,53 @@ int main( int argc, char* argv[] )
         x = solver.getBestX();
         f = solver.getBestF();
 
+        evaluator.threshold( HUGE_VAL );
         evaluator( tag, x, f, msg );
 
         std::ofstream stream;
         stream.open( config.fit_file.c_str() );
+        if( fit_warp )
+        {
+            std::vector< double > warp = evaluator.warp();
+            std::cout << "Final Warp : [ " << warp[ 0 ] << " " << warp[ 1 ] << " " << warp[ 2 ] << " ]" << std::endl;
+            for( int k = 0; k < 3; ++ k ) stream << "# a" << k << " : " << std::setprecision( 15 ) << warp[ k ] << std::endl;
+        }
         stream << std::setprecision( 6 ) << output;
         stream.close();
 
+        if( speculate && workers > 0 ) batch_executor.print();
+
+        for( int t = 0; workers < 1 && t < stack_size; ++ t )
+        {
+            if( incremental )
+            {
+                std::cerr << "thread " << t << " ";
+                stacks[ t ]->opacity.report_builds( std::cerr );
+            }
+            if( early_abort )
+            {
+                std::cerr << "thread " << t << " ";
+                stacks[ t ]->evaluator.report( std::cerr );
+            }
+        }
+
     }
 
     // Worker section.
 
-    if( rank != 0 )
+    if( rank != 0 && batched )
+    {
+        if( children.empty() )
+        {
+            ES::Synapps::Executor::work( evaluator, batch_size, early_abort, parent );
+        }
+        else
+        {
+            ES::Synapps::Executor::relay( batch_size, children );
+        }
+    }
+
+    if( rank != 0 && ! batched )
     {
 
         while( true )
@@ -237,7 +596,28 @@ int main( int argc, char* argv[] )
 
     }
 
-    // Done.
+    if( rank != 0 && children.empty() )
+    {
+
+        if( incremental )
+        {
+            std::cerr << "rank " << rank << " ";
+            opacity.report_builds( std::cerr );
+        }
+
+        if( early_abort )
+        {
+            std::cerr << "rank " << rank << " ";
+            evaluator.report( std::cerr );
+        }
+
+    }
+
+    // Done.  The opacity operators refer to the shared line list, so
+    // they go first.
+
+    for( int t = 0; t < stack_size; ++ t ) delete stacks[ t ];
+    delete line_share;
 
     APPSPACK::GCI::exit();
 